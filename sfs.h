@@ -99,6 +99,21 @@ enum {
     // User tried to delete an open file.
     SFS_ERR_FILE_OPEN,
 
+    // The file system needs to be checked and repaired with sfs_fsck, e.g. because its journal is damaged.
+    SFS_ERR_NEEDS_CHECK,
+
+    // The commit mode passed to sfs_format is invalid, or the file system's commit mode doesn't support snapshots.
+    SFS_ERR_INVALID_MODE,
+
+    // A snapshot is mounted, so the file system can't be changed.
+    SFS_ERR_READ_ONLY,
+
+    // There is no snapshot with that number.
+    SFS_ERR_SNAPSHOT_NOT_FOUND,
+
+    // The file system already has as many snapshots as it can hold.
+    SFS_ERR_TOO_MANY_SNAPSHOTS,
+
 
     // Used to make sure all errors are negative numbers.
     // New error codes should come before it.
@@ -106,6 +121,50 @@ enum {
 };
 
 
+/*
+ * The longest name a file or directory can have, not counting the terminator.
+ */
+#define SFS_MAX_NAME_LENGTH 255
+
+
+/*
+ * One entry in a directory, as filled in by sfs_readdir_batch.
+ */
+typedef struct {
+    // The entry's name.
+    char name[SFS_MAX_NAME_LENGTH + 1];
+
+    // The entry's inode number, which stays the same for as long as it exists.
+    unsigned int inode;
+
+    // What sfs_gettype would return for the entry: zero for a regular file, or one for a directory.
+    int type;
+
+    // What sfs_getsize would return for the entry: the number of bytes in a regular file,
+    //   or the number of entries in a directory.
+    int size;
+
+} sfs_dirent;
+
+
+/*
+ * The ways a file system can commit changes to its metadata, chosen when it is created by sfs_format.
+ */
+enum {
+    // Changed blocks are written to a write-ahead journal, then to where they belong.
+    SFS_MODE_JOURNAL = 0,
+
+    // Changed blocks are written to new locations, and a new superblock pointing at them is written last.
+    // Nothing is written twice, and nothing has to be recovered after a crash.
+    SFS_MODE_COW = 1,
+
+    // Like SFS_MODE_COW, but overwritten data is committed the same way instead of being written in place,
+    //   and each commit's blocks are written together in one segment.
+    // Suits workloads with many small overwrites, which are then written sequentially.
+    SFS_MODE_LOG = 2
+};
+
+
 /*
  * Get a human-readable error message for `error_code`.
  *
@@ -162,6 +221,12 @@ int sfs_read(int fd, int start, int length, char *mem_pointer);
  * This means that if start is not -1, then it is an error for (start + length -1) to be greater than
  * the current length of the file.
  *
+ * Appended data is held in memory and only given blocks later (see sfs_sync), so an error writing it out,
+ *   e.g. SFS_ERR_NO_MORE_BLOCKS, may be returned by sfs_close, sfs_sync or sfs_initialize instead.
+ * An append is only accepted while there are enough free blocks for all the data held in memory.
+ * With SFS_MODE_COW or SFS_MODE_LOG, that leaves out the blocks kept for committing changes,
+ *   so the device can't fill up so far that files can no longer be closed or deleted.
+ *
  * Possible errors:
  *  - SFS_ERR_BAD_FILE_TYPE (must be a data file)
  *  - SFS_ERR_BAD_FD
@@ -170,6 +235,8 @@ int sfs_read(int fd, int start, int length, char *mem_pointer);
  *  - SFS_ERR_NOT_ENOUGH_DATA (when trying to overwrite data that does not exist)
  *  - SFS_ERR_FILE_FULL
  *  - SFS_ERR_INVALID_START_LOC (when `start` is < -1)
+ *  - SFS_ERR_NO_MORE_BLOCKS (when appending, or overwriting data that a snapshot shares)
+ *  - SFS_ERR_READ_ONLY
  */
 int sfs_write(int fd, int start, int length, char *mem_pointer);
 
@@ -188,6 +255,8 @@ int sfs_write(int fd, int start, int length, char *mem_pointer);
  * When all names have been returned, sfs_readdir should place nothing in the buffer,
  * and should return a value of zero to indicate that the directory has been completely scanned.
  *
+ * The buffer must have room for SFS_MAX_NAME_LENGTH + 1 characters.
+ *
  * Possible errors:
  *  - SFS_ERR_BAD_FILE_TYPE (must be a directory file)
  *  - SFS_ERR_BAD_FD
@@ -195,11 +264,35 @@ int sfs_write(int fd, int start, int length, char *mem_pointer);
 int sfs_readdir(int fd, char *mem_pointer);
 
 
+/*
+ * Reads up to `max` entries from a directory file into `entries`, along with their types and sizes.
+ *
+ * This carries on from wherever the last call to sfs_readdir or sfs_readdir_batch for the same descriptor left off,
+ *   so a directory can be listed in a few calls, without looking up each entry's path to get its type and size.
+ * The entries are in the same order that sfs_readdir returns names in.
+ *
+ * Returns the number of entries read, which is zero once the directory has been completely scanned
+ *   (and the next call starts from the beginning again, like sfs_readdir).
+ *
+ * Possible errors:
+ *  - SFS_ERR_BAD_FILE_TYPE (must be a directory file)
+ *  - SFS_ERR_BAD_FD
+ *  - SFS_ERR_BLOCK_IO
+ */
+int sfs_readdir_batch(int fd, sfs_dirent *entries, int max);
+
+
 /*
  * Indicates that the specified file descriptor is no longer needed.
  *
+ * Data appended through it that is still held in memory is written out first.
+ * If that fails, the descriptor stays open, so the data isn't lost and closing it can be tried again.
+ *
  * Possible errors:
  *  - SFS_ERR_BAD_FD
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
  */
 int sfs_close(int fd);
 
@@ -217,6 +310,7 @@ int sfs_close(int fd);
  *  - SFS_ERR_BLOCK_IO
  *  - SFS_ERR_DIR_NOT_EMPTY
  *  - SFS_ERR_CANT_DELETE_ROOT
+ *  - SFS_ERR_READ_ONLY
  */
 int sfs_delete(char *pathname);
 
@@ -242,6 +336,7 @@ int sfs_delete(char *pathname);
  *  - SFS_ERR_INVALID_TYPE (`type` must be either 0 or 1)
  *  - SFS_ERR_NAME_TAKEN
  *  - SFS_ERR_FILE_SYSTEM_FULL
+ *  - SFS_ERR_READ_ONLY
  */
 int sfs_create(char *pathname, int type);
 
@@ -268,6 +363,22 @@ int sfs_getsize(char *pathname);
 int sfs_gettype(char *pathname);
 
 
+/*
+ * Writes all data that is still held in memory to the device.
+ *
+ * Data appended with sfs_write is only given space on the device when the file is closed, when sfs_sync
+ * is called, or when too much data is held in memory.
+ *
+ * Changes to the file system are committed in groups, so they survive a crash once sfs_sync returns.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int sfs_sync(void);
+
+
 /*
  * The sfs_initialize function must be called before any other file system functions are called.
  *
@@ -281,10 +392,85 @@ int sfs_gettype(char *pathname);
  *
  * A new file system should consist of a single, empty root directory and no other directories or regular files.
  *
+ * Mounting only checks the header, since the file system is fully checked by sfs_fsck when it needs to be.
+ * The file system is unmounted, and marked as clean, when sfs_initialize is called again or the program exits.
+ * If it wasn't, the last changes committed to the journal are written again, which makes it consistent.
+ * If the data still held in memory can't be saved when it's unmounted, sfs_initialize fails and it stays mounted.
+ * A file system created with SFS_MODE_COW or SFS_MODE_LOG is always consistent on the device, so it has nothing to recover.
+ *
  * Possible errors:
  *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL (the file system that was mounted couldn't be saved)
  *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_NEEDS_CHECK (the file system wasn't unmounted cleanly, and its journal is damaged)
+ *  - SFS_ERR_NO_MORE_BLOCKS (the file system that was mounted couldn't be saved)
  */
 int sfs_initialize(int erase);
 
+
+/*
+ * Destroys any existing file system on the simulated disk and creates a brand new one,
+ *   like sfs_initialize with erase set to one, which commits changes to its metadata using `mode`.
+ *
+ * `mode` is SFS_MODE_JOURNAL, which is what sfs_initialize uses, SFS_MODE_COW or SFS_MODE_LOG.
+ * The mode is saved in the file system, so sfs_initialize uses it when the file system is mounted again.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_MODE
+ */
+int sfs_format(int mode);
+
+
+/*
+ * Takes a snapshot of the file system as it is now, which can later be mounted with sfs_snapshot_mount_readonly.
+ *
+ * Taking a snapshot copies no data, so it takes the same time however much data there is.
+ * The blocks it refers to can't be reused until it is deleted with sfs_snapshot_delete,
+ *   and changes to data that it shares are written somewhere new, as with SFS_MODE_LOG.
+ *
+ * Only a file system created with SFS_MODE_COW or SFS_MODE_LOG can have snapshots.
+ *
+ * Returns the snapshot's number, which is 0 or more.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_INVALID_MODE
+ *  - SFS_ERR_NO_MORE_BLOCKS (the data held in memory couldn't be written out first)
+ *  - SFS_ERR_READ_ONLY
+ *  - SFS_ERR_TOO_MANY_SNAPSHOTS
+ */
+int sfs_snapshot_create(void);
+
+
+/*
+ * Unmounts the file system and mounts snapshot `snapshot` in its place, read-only.
+ *
+ * Every file and directory is as it was when the snapshot was taken, and any call that would change one fails
+ *   with SFS_ERR_READ_ONLY.
+ * Call sfs_initialize to go back to the live file system.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL (the live file system couldn't be saved, so it's still mounted)
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_INVALID_MODE
+ *  - SFS_ERR_NO_MORE_BLOCKS (the live file system couldn't be saved, so it's still mounted)
+ *  - SFS_ERR_SNAPSHOT_NOT_FOUND
+ */
+int sfs_snapshot_mount_readonly(int snapshot);
+
+
+/*
+ * Deletes snapshot `snapshot`, so that the blocks only it was using can be reused.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_MODE
+ *  - SFS_ERR_READ_ONLY
+ *  - SFS_ERR_SNAPSHOT_NOT_FOUND
+ */
+int sfs_snapshot_delete(int snapshot);
+
 #endif
\ No newline at end of file
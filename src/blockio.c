@@ -132,3 +132,83 @@ int put_block(int blknum, char *buf)
   }
   return(0);
 }
+
+/************************************************
+* get_blocks(blknum,count,buf)
+*    - retrieves count consecutive blocks from the
+*      simulated disk with a single read
+*
+*    - blknum is the number of the first block
+*       (zero-based count)
+*    - buf should point to a buffer of count blocks
+*
+*    - Returns 0 if all count blocks were transferred,
+*      -1 otherwise
+*************************************************/
+int get_blocks(int blknum, int count, char *buf)
+{
+  if (count <= 0 || blknum < 0 || blknum + count > NUMBLKS) {
+    fprintf(stderr,"get_blocks: invalid block range: %d+%d\n",blknum,count);
+    return(-1);
+  }
+  if (diskfd < 0) {
+    /* disk data file is not yet open - attempt to open it */
+    if (init_disk() != 0) return(-1);
+  }
+  /* locate first block */
+  if (lseek(diskfd,blknum*BLKSIZE,SEEK_SET) < 0) {
+    perror("get_blocks");
+    return(-1);
+  }
+  /* get the data - a read may return fewer bytes than asked for,
+     so keep reading until all of the blocks have arrived */
+  for (ssize_t done = 0, got; done < (ssize_t)BLKSIZE*count; done += got) {
+    if ((got = read(diskfd,buf+done,BLKSIZE*count-done)) < 0) {
+      perror("get_blocks");
+      return(-1);
+    }
+    if (got == 0) {
+      fprintf(stderr,"get_blocks: disk data file ends at block %d\n",blknum+(int)(done/BLKSIZE));
+      return(-1);
+    }
+  }
+  return(0);
+}
+
+/************************************************
+* put_blocks(blknum,count,buf)
+*    - writes count consecutive blocks to the
+*      simulated disk with a single write
+*
+*    - blknum is the number of the first block
+*       (zero-based count)
+*    - buf should point to a buffer of count blocks
+*
+*    - Returns 0 if all count blocks were transferred,
+*      -1 otherwise
+*************************************************/
+int put_blocks(int blknum, int count, char *buf)
+{
+  if (count <= 0 || blknum < 0 || blknum + count > NUMBLKS) {
+    fprintf(stderr,"put_blocks: invalid block range: %d+%d\n",blknum,count);
+    return(-1);
+  }
+  if (diskfd < 0) {
+    /* disk data file is not yet open - attempt to open it */
+    if (init_disk() != 0) return(-1);
+  }
+  /* locate first block */
+  if (lseek(diskfd,blknum*BLKSIZE,SEEK_SET) < 0) {
+    perror("put_blocks");
+    return(-1);
+  }
+  /* write the data - a write may take fewer bytes than it was given,
+     so keep writing until all of the blocks are out */
+  for (ssize_t done = 0, put; done < (ssize_t)BLKSIZE*count; done += put) {
+    if ((put = write(diskfd,buf+done,BLKSIZE*count-done)) <= 0) {
+      perror("put_blocks");
+      return(-1);
+    }
+  }
+  return(0);
+}
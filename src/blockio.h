@@ -36,4 +36,24 @@ int get_block(int blknum, char *buf);
 *************************************************/
 int put_block(int blknum, char *buf);
 
+/************************************************
+* get_blocks(blknum,count,buf)
+*    - retrieves count consecutive blocks from the
+*      simulated disk with a single read
+*
+*    - Returns 0 if all count blocks were transferred,
+*      -1 otherwise
+*************************************************/
+int get_blocks(int blknum, int count, char *buf);
+
+/************************************************
+* put_blocks(blknum,count,buf)
+*    - writes count consecutive blocks to the
+*      simulated disk with a single write
+*
+*    - Returns 0 if all count blocks were transferred,
+*      -1 otherwise
+*************************************************/
+int put_blocks(int blknum, int count, char *buf);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,544 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * Reservation - A window of free blocks set aside for a file that is being appended to.
+ *
+ * Other files only allocate from a reserved window when there is nowhere else left,
+ *   so files that grow at the same time don't interleave their blocks.
+ */
+typedef struct {
+    // The file the window is reserved for, or NULL if this reservation is unused.
+    const File *file;
+
+    // The first block of the window.
+    BlockID start;
+
+    // The number of blocks left in the window.
+    unsigned int length;
+
+} Reservation;
+
+static Reservation reservations[MAX_OPEN_FILES];
+
+// The most freed blocks that are zeroed with a single write.
+#define ZERO_RUN_BLOCKS 8
+
+// Blocks and fragments freed since the journal's last commit.
+//
+// The Files on the device may still refer to them until the commit, so they can't be reused before then.
+// A held block is still marked as in use in `freeBlocks`, but a held fragment is no longer in `usedFragments`.
+static bool heldBlocks[MAX_BLOCKS];
+static uint8_t heldFragments[MAX_BLOCKS];
+
+// The most blocks a single operation allocates: flushing a file's pending data,
+//   along with the indirect blocks and the fragment block its tail may need.
+#define OPERATION_ALLOCATION_BLOCKS (MAX_PENDING_BLOCKS + PENDING_MAP_BLOCKS + 1)
+
+// Where to start looking when there is no better goal, i.e. just after the last block allocated.
+static BlockID rotor = 0;
+
+
+/*
+ * Returns `true` if `block` can be given to `file`.
+ *
+ * Blocks in another file's window are only usable if `steal` is `true`.
+ */
+static bool is_usable(BlockID block, const File *file, bool steal) {
+
+    // A block that a snapshot refers to stays as it is until the snapshot is deleted.
+    if (!freeBlocks[block] || Shadow_is_pinned(block)) {
+        return false;
+    }
+
+    if (!steal) {
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            Reservation *reservation = &reservations[i];
+
+            if (reservation->file && reservation->file != file &&
+                block >= reservation->start && block < reservation->start + (BlockID)reservation->length) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Returns the length of the run of usable blocks starting at `start`, up to `limit`.
+ */
+static unsigned int run_length(BlockID start, unsigned int limit, const File *file, bool steal) {
+
+    unsigned int length = 0;
+
+    while (length < limit && start + (BlockID)length < MAX_BLOCKS &&
+           is_usable((BlockID)(start + length), file, steal)) {
+        length++;
+    }
+
+    return length;
+}
+
+
+/*
+ * Finds where to allocate up to `want` blocks for `file`, as close to `goal` as possible.
+ *
+ * If the run can start at `goal` it does.
+ * Otherwise the nearest run that is at least `want` long is picked, or failing that, the longest one.
+ *
+ * Returns `false` if there are no usable blocks at all.
+ */
+static bool find_run(BlockID goal, unsigned int want, const File *file, bool steal,
+                     BlockID *start, unsigned int *length) {
+
+    BlockID bestStart = -1;
+    unsigned int bestLength = 0;
+    int bestDistance = MAX_BLOCKS;
+
+    if (goal >= 0 && goal < MAX_BLOCKS && is_usable(goal, file, steal)) {
+        *start = goal;
+        *length = run_length(goal, want, file, steal);
+        return true;
+    }
+
+    for (BlockID block = 0; block < MAX_BLOCKS; ) {
+        unsigned int length = run_length(block, MAX_BLOCKS, file, steal);
+
+        if (length == 0) {
+            block++;
+            continue;
+        }
+
+        int distance = goal >= 0 ? abs(block - goal) : 0;
+        bool longEnough = length >= want, bestLongEnough = bestLength >= want;
+
+        if (bestStart < 0 || (longEnough && !bestLongEnough) ||
+            (longEnough && distance < bestDistance) ||
+            (!longEnough && !bestLongEnough && length > bestLength)) {
+            bestStart = block;
+            bestLength = length;
+            bestDistance = distance;
+        }
+
+        block = (BlockID)(block + length);
+    }
+
+    if (bestStart < 0) {
+        return false;
+    }
+
+    *start = bestStart;
+    *length = bestLength < want ? bestLength : want;
+    return true;
+}
+
+
+/*
+ * Finds `file`'s reservation, or NULL if it doesn't have one.
+ */
+static Reservation * Reservation_find(const File *file) {
+
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (reservations[i].file == file) {
+            return &reservations[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Sets aside the free blocks starting at `start` for `file`'s next appends.
+ */
+static void Reservation_make(const File *file, BlockID start) {
+
+    Reservation *reservation = Reservation_find(file);
+
+    if (!reservation) {
+        reservation = Reservation_find(NULL);
+    }
+
+    // Only files that are open can hold a reservation, so there is always one free.
+    if (!reservation || start >= MAX_BLOCKS) {
+        return;
+    }
+
+    reservation->file = file;
+    reservation->start = start;
+    reservation->length = run_length(start, RESERVATION_BLOCKS, file, false);
+
+    if (reservation->length == 0) {
+        reservation->file = NULL;
+    }
+}
+
+
+/*
+ * Returns how many of `want` blocks can be allocated without taking the blocks kept for the next commit,
+ *   which only the commit itself may use.
+ */
+static unsigned int allowance(unsigned int want) {
+
+    unsigned int usable = 0, reserve = Journal_is_committing() ? 0 : Shadow_commit_reserve();
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (freeBlocks[i] && !Shadow_is_pinned(i)) {
+            usable++;
+        }
+    }
+
+    if (usable <= reserve) {
+        return 0;
+    }
+
+    return usable - reserve < want ? usable - reserve : want;
+}
+
+
+int Block_allocate_near(const File *file, BlockID goal, unsigned int want, BlockID *_start, unsigned int *_length) {
+
+    BlockID start;
+    unsigned int length;
+    Reservation *reservation = Reservation_find(file);
+
+    // Prefer the file's own window, then any unreserved blocks, then blocks reserved by other files.
+    if (reservation && (goal < 0 || (goal >= reservation->start &&
+                                     goal < reservation->start + (BlockID)reservation->length))) {
+        goal = reservation->start;
+    }
+
+    unsigned int allowed = allowance(want);
+
+    if (allowed == 0 || (!find_run(goal, allowed, file, false, &start, &length) &&
+                         !find_run(goal, allowed, file, true, &start, &length))) {
+        *_start = -1;
+        *_length = 0;
+        return SFS_ERR_NO_MORE_BLOCKS;
+    }
+
+    for (unsigned int i = 0; i < length; i++) {
+        freeBlocks[start + i] = false;
+    }
+    rotor = (BlockID)(start + length);
+
+    // Keep the window just past the file's new last block.
+    Reservation_make(file, (BlockID)(start + length));
+
+    *_start = start;
+    *_length = length;
+    return 0;
+}
+
+
+int Block_allocate(BlockID *block) {
+
+    unsigned int length;
+
+    if (allowance(1) == 0 || (!find_run(rotor, 1, NULL, false, block, &length) &&
+                     !find_run(rotor, 1, NULL, true, block, &length))) {
+        *block = -1;
+        return SFS_ERR_NO_MORE_BLOCKS;
+    }
+
+    freeBlocks[*block] = false;
+    rotor = (BlockID)(*block + 1);
+    return 0;
+}
+
+
+unsigned int Block_count_free(void) {
+
+    unsigned int count = 0;
+
+    // Held blocks are counted, since the next operation that might need them commits first (see Journal_begin).
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if ((freeBlocks[i] || heldBlocks[i]) && !Shadow_is_pinned(i)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+void Block_free(BlockID block) {
+    heldBlocks[block] = true;
+}
+
+
+bool Block_should_release_held(void) {
+
+    bool anyHeld = false;
+
+    for (BlockID i = 0; i < MAX_BLOCKS && !anyHeld; i++) {
+        anyHeld = heldBlocks[i];
+    }
+
+    return anyHeld && allowance(OPERATION_ALLOCATION_BLOCKS) < OPERATION_ALLOCATION_BLOCKS;
+}
+
+
+bool Block_is_held(BlockID block) {
+    return heldBlocks[block];
+}
+
+
+void Block_release_held(void) {
+
+    char zeroes[ZERO_RUN_BLOCKS * BLOCK_SIZE];
+    memset(zeroes, 0, sizeof(zeroes));
+
+    for (BlockID i = 0; i < MAX_BLOCKS; ) {
+        // A snapshot may still refer to the block, so it's freed without being zeroed.
+        if (Shadow_is_pinned(i)) {
+            if (heldBlocks[i]) {
+                freeBlocks[i] = true;
+                heldBlocks[i] = false;
+            }
+            heldFragments[i] = 0;
+            i++;
+            continue;
+        }
+
+        // Zero runs of whole blocks together.
+        if (heldBlocks[i]) {
+            BlockID start = i;
+
+            while (i < MAX_BLOCKS && heldBlocks[i] && !Shadow_is_pinned(i) && i - start < ZERO_RUN_BLOCKS) {
+                freeBlocks[i] = true;
+                heldBlocks[i] = false;
+                heldFragments[i] = 0;
+                i++;
+            }
+
+            if (put_blocks(start, i - start, zeroes) != 0) {
+                debug("Could not zero freed blocks.");
+            }
+            continue;
+        }
+
+        // The block may still hold other files' tails, so only the freed fragments are cleared.
+        if (heldFragments[i]) {
+            char buffer[BLOCK_SIZE];
+
+            if (get_block(i, buffer) == 0) {
+                for (unsigned int j = 0; j < FRAGMENTS_PER_BLOCK; j++) {
+                    if (heldFragments[i] & (1u << j)) {
+                        memset(buffer + j * FRAGMENT_SIZE, 0, FRAGMENT_SIZE);
+                    }
+                }
+                put_block(i, buffer);
+            }
+            heldFragments[i] = 0;
+        }
+
+        i++;
+    }
+}
+
+
+void Block_forget_held(void) {
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        heldBlocks[i] = false;
+        heldFragments[i] = 0;
+    }
+}
+
+
+/*
+ * Returns the number of fragments of `block` that are not in use.
+ */
+static unsigned int free_fragments(BlockID block) {
+
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i < FRAGMENTS_PER_BLOCK; i++) {
+        if (!((usedFragments[block] | heldFragments[block]) & (1u << i))) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+int Fragment_allocate(unsigned int count, BlockID *_block, uint8_t *_first) {
+
+    int err_code = 0;
+    unsigned int mask = (1u << count) - 1;
+    BlockID block = -1;
+    unsigned int first = 0, blockFree = FRAGMENTS_PER_BLOCK;
+
+    // Fill up the fullest block that still has room, so that partly used blocks stay few.
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        unsigned int freeCount;
+
+        if (usedFragments[i] == 0 || (freeCount = free_fragments(i)) < count || freeCount >= blockFree) {
+            continue;
+        }
+
+        for (unsigned int j = 0; j + count <= FRAGMENTS_PER_BLOCK; j++) {
+            if (!((usedFragments[i] | heldFragments[i]) & (mask << j))) {
+                block = i;
+                first = j;
+                blockFree = freeCount;
+                break;
+            }
+        }
+    }
+
+    if (block < 0) {
+        check_err(Block_allocate(&block));
+        first = 0;
+    }
+
+    usedFragments[block] |= (uint8_t)(mask << first);
+
+    *_block = block;
+    *_first = (uint8_t)first;
+    return 0;
+
+error:
+    *_block = -1;
+    return err_code;
+}
+
+
+void Fragment_free(BlockID block, uint8_t first, unsigned int count) {
+
+    uint8_t mask = (uint8_t)(((1u << count) - 1) << first);
+
+    usedFragments[block] &= (uint8_t)~mask;
+    heldFragments[block] |= mask;
+
+    if (usedFragments[block] == 0) {
+        Block_free(block);
+    }
+}
+
+
+void Bitmap_encode(uint8_t *bitmap) {
+
+    memset(bitmap, 0, BITMAP_BLOCKS * BLOCK_SIZE);
+
+    // Held blocks are saved as free, since they will be by the time the bitmap is committed.
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        bitmap[i] = (uint8_t)((freeBlocks[i] || heldBlocks[i] ? 0 : BITMAP_USED) | usedFragments[i]);
+    }
+}
+
+
+/*
+ * Reads the allocation bitmap on the device into `bitmap`.
+ *
+ * In copy-on-write mode its blocks may not be next to each other, so they're read one at a time.
+ */
+static int read_bitmap(uint8_t *bitmap) {
+
+    int err_code = 0;
+
+    if (commitMode == COMMIT_JOURNAL) {
+        check(get_blocks(BITMAP_START, BITMAP_BLOCKS, (char *)bitmap) == 0, SFS_ERR_BLOCK_IO);
+        return 0;
+    }
+
+    for (BlockID i = 0; i < BITMAP_BLOCKS; i++) {
+        check_err(Journal_get_block(BITMAP_START + i, (char *)bitmap + i * BLOCK_SIZE));
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Bitmap_load(void) {
+
+    int err_code = 0;
+    uint8_t bitmap[BITMAP_BLOCKS * BLOCK_SIZE];
+
+    check_err(read_bitmap(bitmap));
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        uint8_t fragments = (uint8_t)(bitmap[i] & ~BITMAP_USED);
+
+        // A block with fragments in use must be in use itself.
+        check(fragments < (1u << FRAGMENTS_PER_BLOCK), SFS_ERR_INVALID_DATA_FILE);
+        check(fragments == 0 || (bitmap[i] & BITMAP_USED), SFS_ERR_INVALID_DATA_FILE);
+
+        freeBlocks[i] = !(bitmap[i] & BITMAP_USED);
+        usedFragments[i] = fragments;
+    }
+
+    // The header, the bitmap itself and the journal are always in use.
+    for (BlockID i = 0; i < FIRST_DATA_BLOCK; i++) {
+        check(!freeBlocks[i], SFS_ERR_INVALID_DATA_FILE);
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Bitmap_compare(bool *matches) {
+
+    int err_code = 0;
+    uint8_t bitmap[BITMAP_BLOCKS * BLOCK_SIZE], saved[BITMAP_BLOCKS * BLOCK_SIZE];
+
+    Bitmap_encode(bitmap);
+    check_err(read_bitmap(saved));
+
+    *matches = memcmp(bitmap, saved, MAX_BLOCKS) == 0;
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+void Reservation_release(const File *file) {
+
+    if (file == NULL) {
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            reservations[i].file = NULL;
+        }
+        rotor = 0;
+        return;
+    }
+
+    Reservation *reservation = Reservation_find(file);
+    if (reservation) {
+        reservation->file = NULL;
+    }
+}
@@ -0,0 +1,297 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "sfs_internal.h"
+
+/*
+ * Marks a run of blocks belonging to a File as used, counting the data blocks in `context`.
+ *
+ * Fails if any of them are already in use.
+ */
+static int claim_blocks(BlockID start, unsigned int length, bool isMap, void *context) {
+
+    int err_code = 0;
+    size_t *blocksInUse = context;
+
+    check(start >= FIRST_DATA_BLOCK && start + length <= MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
+
+    for (unsigned int i = 0; i < length; i++) {
+        check(freeBlocks[start + i], SFS_ERR_INVALID_DATA_FILE);
+        freeBlocks[start + i] = false;
+    }
+
+    if (!isMap) {
+        *blocksInUse += length;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+/*
+ * Marks the fragments holding a data file's tail as used.
+ *
+ * Fails if any of them are already in use, or if their block is used for something else.
+ */
+static int claim_fragments(const File *file) {
+
+    int err_code = 0;
+    unsigned int count = File_tail_fragments(file);
+    unsigned int mask = ((1u << count) - 1) << file->tailFragment;
+
+    check(count > 0 && count < FRAGMENTS_PER_BLOCK, SFS_ERR_INVALID_DATA_FILE);
+    check(file->tailFragment + count <= FRAGMENTS_PER_BLOCK, SFS_ERR_INVALID_DATA_FILE);
+    check(file->tailBlock >= FIRST_DATA_BLOCK && file->tailBlock < MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
+
+    // The block must either be free, or already hold other tails that don't overlap this one.
+    check(freeBlocks[file->tailBlock] || usedFragments[file->tailBlock] != 0, SFS_ERR_INVALID_DATA_FILE);
+    check((usedFragments[file->tailBlock] & mask) == 0, SFS_ERR_INVALID_DATA_FILE);
+
+    freeBlocks[file->tailBlock] = false;
+    usedFragments[file->tailBlock] |= (uint8_t)mask;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+/*
+ * Marks the NAME files holding a File's long name as used in `nameParts`.
+ *
+ * Fails if any of them are missing, or already hold part of another name.
+ */
+static int claim_name(const File *file, bool *nameParts) {
+
+    int err_code = 0;
+    FileID id = file->nameFirst;
+
+    check(file->nameLength > INODE_NAME_LENGTH, SFS_ERR_INVALID_DATA_FILE);
+
+    for (unsigned int i = 0; i < (file->nameLength + NAME_PART_LENGTH - 1u) / NAME_PART_LENGTH; i++) {
+        check(id < File_count() && !nameParts[id], SFS_ERR_INVALID_DATA_FILE);
+
+        File *part = File_get(id);
+        check(part != NULL, SFS_ERR_OUT_OF_MEMORY);
+        check(part->type == FTYPE_NAME, SFS_ERR_INVALID_DATA_FILE);
+
+        nameParts[id] = true;
+        id = part->nameNext;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+/*
+ * Checks a single File, marking its blocks and the parts of its name as used and counting it in its parent's `children`.
+ */
+static int check_file(File *file, size_t *children, bool *nameParts) {
+
+    int err_code = 0;
+
+    // i. Ensure that the type is valid.
+    check(file->type == FTYPE_NONE || file->type == FTYPE_NAME || File_is_data(file) || File_is_directory(file),
+          SFS_ERR_INVALID_DATA_FILE);
+
+    // The parts of names are checked along with the Files they belong to.
+    if (file->type == FTYPE_NONE || file->type == FTYPE_NAME) {
+        return 0;
+    }
+
+    if (file->flags & FILE_LONG_NAME) {
+        check_err(claim_name(file, nameParts));
+    }
+
+    // ii. Ensure that the parent exists and is a directory.
+    if (file->parentDirectoryID != FILE_ID_NONE) {
+        check(file->parentDirectoryID < File_count(), SFS_ERR_INVALID_DATA_FILE);
+
+        File *parent = File_get_parent(file);
+        check(parent != NULL, SFS_ERR_OUT_OF_MEMORY);
+        // Make sure the parent is a directory.
+        check(File_is_directory(parent), SFS_ERR_INVALID_DATA_FILE);
+        // Make sure the parent isn't this file.
+        check(parent != file, SFS_ERR_INVALID_DATA_FILE);
+
+        children[file->parentDirectoryID]++;
+    }
+    else {
+        // The only active file without a parent is the root directory.
+        check(file->id == 0, SFS_ERR_INVALID_DATA_FILE);
+    }
+
+    // iii. If the File is a data file
+    if (File_is_data(file)) {
+        // 1. For each block, ensure that the block is unused and mark it at used.
+        size_t blocksInUse = 0;
+        check_err(File_walk_blocks(file, claim_blocks, &blocksInUse));
+
+        // 2. Ensure that the File’s size is consistent with the number of blocks it is using.
+        if (File_is_inline(file)) {
+            check(file->size <= INLINE_DATA_SIZE, SFS_ERR_INVALID_DATA_FILE);
+        }
+        else if (File_has_tail(file)) {
+            // The last block is in fragments, so only the whole blocks are in the File's extents.
+            check(file->size / BLOCK_SIZE == blocksInUse, SFS_ERR_INVALID_DATA_FILE);
+            check_err(claim_fragments(file));
+        }
+        else {
+            check((file->size + BLOCK_SIZE - 1) / BLOCK_SIZE == blocksInUse, SFS_ERR_INVALID_DATA_FILE);
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+int FileSystem_check(bool repair) {
+
+    int err_code = 0;
+    FileSystemHeader header;
+    size_t *children = NULL;
+    bool *nameParts = NULL;
+    bool needsRepair = false;
+
+    // Whatever is in memory may not match the device, so start from nothing.
+    // The file system is left mounted if it can't be saved, rather than thrown away below.
+    int saved = FileSystem_unmount(true);
+    if (saved < 0) {
+        return saved;
+    }
+
+    // 1. Ensure that all the header’s fields are valid.
+    check_err(FileSystemHeader_read(&header));
+    needsRepair = !header.clean;
+
+    // The last transaction in the journal may not have made it to the device, which looks like damage.
+    //   So unless the journal can be recovered first, there is no point in checking any further.
+    if (!header.clean) {
+        check(repair, SFS_ERR_NEEDS_CHECK);
+        check_err(Journal_recover());
+        check_err(FileSystemHeader_read(&header));
+    }
+
+    // 2. The header, the allocation bitmap and the journal are always in use, and the rest is worked out from the Files.
+    for (int i = 0; i < FIRST_DATA_BLOCK; i++) {
+        freeBlocks[i] = false;
+    }
+
+    // 3. Load the inode table, and mark its blocks as used.
+    size_t tableBlocks = 0;
+    check_err(InodeTable_load(header.inodeTable));
+    check_err(File_walk_blocks(&inodeTable, claim_blocks, &tableBlocks));
+    check(tableBlocks * BLOCK_SIZE == inodeTable.size, SFS_ERR_INVALID_DATA_FILE);
+
+    // In copy-on-write mode, the blocks holding moved copies of metadata and the shadow map are in use too.
+    check_err(Shadow_walk_blocks(claim_blocks, &tableBlocks));
+
+    // 4. Ensure that the first File is the root directory.
+    File *root = File_get(0);
+    check(root != NULL, SFS_ERR_OUT_OF_MEMORY);
+    check(File_is_directory(root), SFS_ERR_INVALID_DATA_FILE);
+    check(strcmp(root->name, "/") == 0, SFS_ERR_INVALID_DATA_FILE);
+    check(root->parentDirectoryID == FILE_ID_NONE, SFS_ERR_INVALID_DATA_FILE);
+
+    // 5. Check each File, counting how many Files each directory contains.
+    children = calloc(File_count(), sizeof(size_t));
+    check_mem(children);
+    nameParts = calloc(File_count(), sizeof(bool));
+    check_mem(nameParts);
+
+    for (FileID id = 0; id < File_count(); id++) {
+        // Only a few Files are needed at a time, so they don't all have to fit in memory at once.
+        InodeCache_trim();
+
+        File *file = File_get(id);
+        check(file != NULL, SFS_ERR_OUT_OF_MEMORY);
+        check_err(check_file(file, children, nameParts));
+    }
+
+    // Every block in use has been claimed, so repairs can go through a transaction like any other change.
+    //   The journal has been recovered by now, so it's started again from empty.
+    if (repair) {
+        if (commitMode == COMMIT_JOURNAL) {
+            check_err(Journal_format());
+        }
+        check_err(Journal_start(false));
+    }
+
+    // 6. Ensure that each directory's size is the number of Files it contains,
+    //    and free the parts of names that no File is using, e.g. because the File was never saved.
+    for (FileID id = 0; id < File_count(); id++) {
+        InodeCache_trim();
+
+        File *file = File_get(id);
+        check(file != NULL, SFS_ERR_OUT_OF_MEMORY);
+
+        if (file->type == FTYPE_NAME && !nameParts[id]) {
+            needsRepair = true;
+
+            if (repair) {
+                memset(file, 0, sizeof(*file));
+                file->id = id;
+                check_err(File_save(file));
+            }
+        }
+
+        if (File_is_directory(file) && file->size != children[id]) {
+            needsRepair = true;
+
+            if (repair) {
+                file->size = children[id];
+                check_err(File_save(file));
+            }
+        }
+    }
+
+    // 7. Ensure that the allocation bitmap matches the blocks the Files use.
+    bool matches;
+    check_err(Bitmap_compare(&matches));
+    needsRepair = needsRepair || !matches;
+
+    if (repair) {
+        check_err(Journal_stop());
+        check_err(FileSystemHeader_set_clean(true));
+    }
+    else {
+        check(!needsRepair, SFS_ERR_NEEDS_CHECK);
+    }
+
+    free(children);
+    free(nameParts);
+    FileSystem_unmount(false);
+    return 0;
+
+error:
+    free(children);
+    free(nameParts);
+    FileSystem_unmount(false);
+    return err_code;
+}
@@ -25,12 +25,28 @@ int sfs_close(int fd) {
     int err_code;
     OpenFile *oFile;
 
+    InodeCache_trim();
+    check_err(Journal_begin());
+
     oFile = OpenFile_find_by_descriptor(fd);
     check(oFile != NULL, SFS_ERR_BAD_FD);
 
-    oFile->lastRead = NULL;
+    oFile->lastRead = FILE_ID_NONE;
+
+    // Blocks are only given to appended data once it's no longer being written.
+    check_err(File_flush(oFile->file));
+
+    // Once the last descriptor for a File is closed, it is no longer being appended to.
+    File *file = oFile->file;
     oFile->file = NULL;
 
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (openFiles[i].file == file) {
+            return 0;
+        }
+    }
+    Reservation_release(file);
+
     return 0;
 
 error:
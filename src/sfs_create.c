@@ -22,49 +22,61 @@
 
 int sfs_create(char *pathname, int type) {
     int err_code;
-    char **tokens = NULL;
+    PathIterator iterator;
     File *file = NULL;
-    File *pFile = &files[0];
-    int i;
+    File *pFile = NULL;
     FileID parentID;
-    err_code = (File_find_by_path(&file, pathname));
-    //check if file is null
-    check(err_code == SFS_ERR_FILE_NOT_FOUND, err_code ? err_code : SFS_ERR_NAME_TAKEN);
+    InodeCache_trim();
+    check(!readOnly, SFS_ERR_READ_ONLY);
+    check_err(Journal_begin());
+    // The root directory always exists.
+    check(strcmp(pathname, "/") != 0, SFS_ERR_NAME_TAKEN);
+    // Walk the path once, to the directory the File goes in, and make sure the name isn't taken there.
+    check_err(File_find_parent_by_path(&pFile, &iterator, pathname));
+    check(File_find_component_in_dir(iterator.component, iterator.length, pFile) == NULL, SFS_ERR_NAME_TAKEN);
     // Make sure `type` is either 0 or 1.
     check(type == 0 || type == 1, SFS_ERR_INVALID_TYPE);
 
     file = File_find_empty();
     check(file != NULL, SFS_ERR_FILE_SYSTEM_FULL);
 
-    check_err(path_to_tokens(pathname, &tokens));
-    // Reserve enough space for the worst-case scenario.
-    char parentPath[MAX_FILES * (MAX_PATH_COMPONENT_LENGTH+1)] = "";
-    for (i = 0; tokens[i+1] != NULL; i++) {
-        strcat(parentPath, "/");
-        strcat(parentPath, tokens[i]);
-        check_err(File_find_by_path(&pFile, parentPath));
-        check(File_is_directory(pFile), SFS_ERR_BAD_FILE_TYPE);
-    }
-
     parentID = File_get_id(pFile);
     file->type = type == 0 ? FTYPE_DATA : FTYPE_DIR;
     file->parentDirectoryID = parentID;
-    strcpy(file->name,tokens[i]);
+    file->flags = 0;
 
     if (File_is_data(file))
     {
-        for(i = 0; i < MAX_BLOCKS_PER_FILE; i++)
-        {
-            file->blocks[i] = -1;
+        // New files are empty, so their contents start out inside the File.
+        memset(file->inlineData, 0, sizeof(file->inlineData));
+        file->flags = FILE_INLINE;
+    }
+    else
+    {
+        file->dirIndex = NULL;
+    }
+    // A long name is split between other Files, which are saved before this one so that it never refers to missing parts.
+    err_code = File_set_name(file, iterator.component, iterator.length);
+    if (err_code == 0) {
+        err_code = File_add_file_to_dir(file, iterator.component, iterator.length, pFile);
+        if (err_code < 0) {
+            // Give back the parts of the name, since the File won't be using them.
+            File_free_name(file);
         }
     }
-    check_err(File_add_file_to_dir(file, pFile));
+    if (err_code < 0) {
+        // Leave the File empty again, so it isn't mistaken for one that exists.
+        FileID id = file->id;
+        memset(file, 0, sizeof(*file));
+        file->id = id;
+        file->type = FTYPE_NONE;
+        sentinel(err_code);
+    }
 
     check_err(File_save(file));
-    free_tokens(&tokens);
+    check_err(File_save(pFile));
     return 0;
 
 error:
-    free_tokens(&tokens);
     return err_code;
 }
@@ -27,8 +27,10 @@ int sfs_delete(char *pathname) {
     File *file = NULL;
     File *pFile = NULL;
     int i;
-    char zeroBuffer[BLOCK_SIZE];
     //Code
+    InodeCache_trim();
+    check(!readOnly, SFS_ERR_READ_ONLY);
+    check_err(Journal_begin());
     check(strcmp(pathname,"/")!= 0, SFS_ERR_CANT_DELETE_ROOT);
     check_err(File_find_by_path(&file,pathname));
     check_err(err_code == SFS_ERR_FILE_NOT_FOUND);
@@ -41,23 +43,26 @@ int sfs_delete(char *pathname) {
 
     if(File_is_directory(file))
     {
-        check(file->dirContents == NULL,SFS_ERR_DIR_NOT_EMPTY);
+        check(file->size == 0,SFS_ERR_DIR_NOT_EMPTY);
     }
 
     pFile = File_get_parent(file);
     File_remove_file_from_dir(file,pFile);
-    memset(zeroBuffer, 0, BLOCK_SIZE);
+    check_err(File_save(pFile));
 
-    for(i = 0; i < MAX_BLOCKS_PER_FILE; i++)
+    if (File_is_data(file))
     {
-        if(file->blocks[i] == -1)
-        {
-            break;
-        }
-        put_block(file->blocks[i], zeroBuffer);
+        // Data that was never flushed never got any blocks, so there's nothing to free for it.
+        PendingData_discard(file);
+        check_err(File_free_blocks(file));
     }
 
+    check_err(File_free_name(file));
+
+    // The File's ID is where it is in the inode table, so it stays the same.
+    FileID id = file->id;
     memset(file, 0, sizeof(*file));
+    file->id = id;
     check_err(File_save(file));
 
     return 0;
@@ -0,0 +1,123 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+
+#include "../sfs.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * Dentry - A path that has been looked up, and what it was found to be.
+ */
+typedef struct {
+    // The path, or an empty string if this entry is unused.
+    char path[DENTRY_PATH_LENGTH + 1];
+
+    // The File the path leads to, or FILE_ID_NONE if there is no such File.
+    FileID id;
+
+    // The generation the entry was made in. It's only valid while that generation is current.
+    uint32_t generation;
+
+} Dentry;
+
+// The paths looked up, each in the entry its hash picks.
+static Dentry dentries[DENTRY_CACHE_SIZE];
+
+// Creating a File can only make paths that didn't exist resolve, and deleting one can only make paths that did exist fail,
+//   so each kind of entry has its own generation, and only that one is moved on when a directory changes.
+static uint32_t foundGeneration = 1, missingGeneration = 1;
+
+
+/*
+ * Returns the entry that the `length` character path at `path` would be cached in.
+ */
+static Dentry * Dentry_for_path(const char *path, size_t length) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619U;
+    }
+
+    return &dentries[hash & (DENTRY_CACHE_SIZE - 1)];
+}
+
+
+bool DentryCache_lookup(const char *path, size_t length, FileID *id) {
+
+    if (length > DENTRY_PATH_LENGTH) {
+        return false;
+    }
+
+    Dentry *dentry = Dentry_for_path(path, length);
+    uint32_t generation = dentry->id == FILE_ID_NONE ? missingGeneration : foundGeneration;
+
+    if (dentry->generation != generation || strncmp(dentry->path, path, length) != 0 || dentry->path[length] != '\0') {
+        return false;
+    }
+
+    *id = dentry->id;
+    return true;
+}
+
+
+void DentryCache_insert(const char *path, size_t length, FileID id) {
+
+    if (length > DENTRY_PATH_LENGTH) {
+        return;
+    }
+
+    // Whatever was in the entry before is replaced.
+    Dentry *dentry = Dentry_for_path(path, length);
+
+    memcpy(dentry->path, path, length);
+    dentry->path[length] = '\0';
+    dentry->id = id;
+    dentry->generation = id == FILE_ID_NONE ? missingGeneration : foundGeneration;
+}
+
+
+void DentryCache_file_added(void) {
+
+    // Once the generation wraps around, old entries could look current again.
+    if (++missingGeneration == 0) {
+        DentryCache_clear();
+    }
+}
+
+
+void DentryCache_file_removed(void) {
+
+    if (++foundGeneration == 0) {
+        DentryCache_clear();
+    }
+}
+
+
+void DentryCache_clear(void) {
+
+    memset(dentries, 0, sizeof(dentries));
+    foundGeneration = 1;
+    missingGeneration = 1;
+}
@@ -45,6 +45,11 @@ static const char *errorMessages[] = {
     "The blocks are not large enough to hold a single File object.",            // SFS_ERR_BLOCKS_TOO_SMALL_FOR_FILE
     "Deleting the root directory is not permitted.",                            // SFS_ERR_CANT_DELETE_ROOT
     "You must close that file before deleting it.",                             // SFS_ERR_FILE_OPEN
+    "The file system is damaged, run sfs_fsck to repair it.",                   // SFS_ERR_NEEDS_CHECK
+    "The commit mode is invalid, or doesn't support snapshots.",                // SFS_ERR_INVALID_MODE
+    "A snapshot is mounted, so the file system is read-only.",                  // SFS_ERR_READ_ONLY
+    "There is no snapshot with that number.",                                   // SFS_ERR_SNAPSHOT_NOT_FOUND
+    "The file system already has as many snapshots as it can hold.",            // SFS_ERR_TOO_MANY_SNAPSHOTS
 };
 
 const char *sfs_error_message(int error_code) {
@@ -0,0 +1,555 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * MapBlock - A decoded indirect or double indirect block.
+ *
+ * Recently used map blocks are kept in `mapCache` so that looking up a block
+ *   in a large file doesn't have to read the whole chain of indirect blocks again.
+ *
+ * The cache is write-through, so an entry can be dropped at any time.
+ * Loading a block replaces the least recently used entry, so the two most
+ *   recently loaded entries are always safe to hold on to.
+ */
+typedef struct {
+    // The block this was loaded from, or -1 if the entry is unused.
+    BlockID block;
+
+    // `true` if this is a double indirect block, otherwise it's an indirect block.
+    bool isDouble;
+
+    // The value of `mapCacheClock` when this entry was last used.
+    unsigned int lastUse;
+
+    // The number of extents (or references to indirect blocks) in use.
+    unsigned int used;
+
+    // The total length of the extents covered by this block.
+    uint32_t length;
+
+    union {
+        Extent extents[EXTENTS_PER_BLOCK];
+        IndirectExtent indirects[INDIRECTS_PER_BLOCK];
+        char data[BLOCK_SIZE];
+    };
+
+} MapBlock;
+
+static MapBlock mapCache[MAP_CACHE_SIZE];
+static unsigned int mapCacheClock = 0;
+static bool mapCacheReady = false;
+
+
+/*
+ * Finds block number `*index` in a list of extents.
+ *
+ * Returns the block, or -1 if it's past the end of the list, in which case
+ *   the blocks covered by the list are subtracted from `*index`.
+ */
+static BlockID find_in_extents(const Extent *extents, size_t count, unsigned int *index) {
+
+    for (size_t i = 0; i < count && extents[i].length > 0; i++) {
+        if (*index < extents[i].length) {
+            return (BlockID)(extents[i].start + *index);
+        }
+        *index -= extents[i].length;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Appends `block` to a list of extents, growing `last` if the block follows it.
+ *
+ * Returns `true` if the block was added, or `false` if the list is full.
+ */
+static bool append_to_extents(Extent *extents, size_t count, Extent *last, BlockID block) {
+
+    if (last && last->start + last->length == block && last->length < UINT16_MAX) {
+        last->length++;
+        return true;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (extents[i].length == 0) {
+            extents[i].start = block;
+            extents[i].length = 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Returns the last extent in use in a list of extents, or NULL if none are.
+ */
+static Extent * last_extent(Extent *extents, size_t count) {
+
+    Extent *last = NULL;
+
+    for (size_t i = 0; i < count && extents[i].length > 0; i++) {
+        last = &extents[i];
+    }
+
+    return last;
+}
+
+
+void MapCache_clear(void) {
+
+    for (int i = 0; i < MAP_CACHE_SIZE; i++) {
+        mapCache[i].block = -1;
+    }
+
+    mapCacheReady = true;
+}
+
+
+/*
+ * Recomputes the number of entries in use and their total length.
+ */
+static void MapBlock_decode(MapBlock *mapBlock) {
+
+    mapBlock->used = 0;
+    mapBlock->length = 0;
+
+    if (mapBlock->isDouble) {
+        while (mapBlock->used < INDIRECTS_PER_BLOCK && mapBlock->indirects[mapBlock->used].length > 0) {
+            mapBlock->length += mapBlock->indirects[mapBlock->used].length;
+            mapBlock->used++;
+        }
+    }
+    else {
+        while (mapBlock->used < EXTENTS_PER_BLOCK && mapBlock->extents[mapBlock->used].length > 0) {
+            mapBlock->length += mapBlock->extents[mapBlock->used].length;
+            mapBlock->used++;
+        }
+    }
+}
+
+
+/*
+ * Finds an entry for `block`, evicting the least recently used one if it isn't cached.
+ *
+ * Returns `true` if `block` was already cached.
+ */
+static bool MapBlock_find_slot(BlockID block, MapBlock **_mapBlock) {
+
+    MapBlock *victim = NULL;
+
+    if (!mapCacheReady) {
+        MapCache_clear();
+    }
+
+    for (int i = 0; i < MAP_CACHE_SIZE; i++) {
+        MapBlock *mapBlock = &mapCache[i];
+
+        if (mapBlock->block == block) {
+            mapBlock->lastUse = ++mapCacheClock;
+            *_mapBlock = mapBlock;
+            return true;
+        }
+
+        if (!victim || mapBlock->block < 0 || (victim->block >= 0 && mapBlock->lastUse < victim->lastUse)) {
+            victim = mapBlock;
+        }
+    }
+
+    victim->block = block;
+    victim->lastUse = ++mapCacheClock;
+    *_mapBlock = victim;
+    return false;
+}
+
+
+/*
+ * Gets the decoded contents of map block `block`, reading it if it isn't cached.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+static int MapBlock_load(BlockID block, bool isDouble, MapBlock **_mapBlock) {
+
+    int err_code = 0;
+    MapBlock *mapBlock;
+
+    if (!MapBlock_find_slot(block, &mapBlock)) {
+        err_code = Journal_get_block(block, mapBlock->data);
+        if (err_code < 0) {
+            mapBlock->block = -1;
+            sentinel(err_code);
+        }
+
+        mapBlock->isDouble = isDouble;
+        MapBlock_decode(mapBlock);
+    }
+
+    *_mapBlock = mapBlock;
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Allocates a new, empty map block.
+ *
+ * Possible errors:
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+static int MapBlock_create(bool isDouble, MapBlock **_mapBlock) {
+
+    int err_code = 0;
+    BlockID block;
+    MapBlock *mapBlock;
+
+    check_err(Block_allocate(&block));
+    MapBlock_find_slot(block, &mapBlock);
+
+    memset(mapBlock->data, 0, sizeof(mapBlock->data));
+    mapBlock->isDouble = isDouble;
+    MapBlock_decode(mapBlock);
+
+    *_mapBlock = mapBlock;
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Writes a map block back to the disk after it was changed.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+static int MapBlock_save(MapBlock *mapBlock) {
+
+    int err_code = 0;
+
+    MapBlock_decode(mapBlock);
+    check_err(Journal_put_block(mapBlock->block, mapBlock->data));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Releases a map block that was just created but isn't needed after all.
+ */
+static void MapBlock_discard(MapBlock *mapBlock) {
+    freeBlocks[mapBlock->block] = true;
+    mapBlock->block = -1;
+}
+
+
+int File_get_block(const File *file, unsigned int index, BlockID *block) {
+
+    int err_code = 0;
+    MapBlock *mapBlock;
+
+    // Inline Files don't have any blocks.
+    if (File_is_inline(file)) {
+        *block = -1;
+        return 0;
+    }
+
+    *block = find_in_extents(file->extents, INODE_EXTENTS, &index);
+    if (*block >= 0) {
+        return 0;
+    }
+
+    if (file->indirectBlock >= 0) {
+        check_err(MapBlock_load(file->indirectBlock, false, &mapBlock));
+
+        if (index < mapBlock->length) {
+            *block = find_in_extents(mapBlock->extents, mapBlock->used, &index);
+            return 0;
+        }
+        index -= mapBlock->length;
+    }
+
+    if (file->doubleIndirectBlock >= 0) {
+        check_err(MapBlock_load(file->doubleIndirectBlock, true, &mapBlock));
+
+        // Skip over whole indirect blocks until the one that holds `index` is found.
+        for (unsigned int i = 0; i < mapBlock->used; i++) {
+            IndirectExtent *indirect = &mapBlock->indirects[i];
+
+            if (index < indirect->length) {
+                check_err(MapBlock_load(indirect->block, false, &mapBlock));
+                *block = find_in_extents(mapBlock->extents, mapBlock->used, &index);
+                return 0;
+            }
+            index -= indirect->length;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_append_block(File *file, BlockID block) {
+
+    int err_code = 0;
+    MapBlock *doubleIndirect = NULL, *indirect = NULL;
+    // Map blocks created by this call, which are given back if it fails.
+    MapBlock *created[2] = {NULL, NULL};
+
+    // The File's own extents are used first, then the indirect block, then the double indirect block.
+    if (file->doubleIndirectBlock >= 0) {
+        check_err(MapBlock_load(file->doubleIndirectBlock, true, &doubleIndirect));
+        IndirectExtent *last = &doubleIndirect->indirects[doubleIndirect->used - 1];
+
+        check_err(MapBlock_load(last->block, false, &indirect));
+        if (append_to_extents(indirect->extents, EXTENTS_PER_BLOCK,
+                              last_extent(indirect->extents, indirect->used), block)) {
+            check_err(MapBlock_save(indirect));
+            last->length++;
+            check_err(MapBlock_save(doubleIndirect));
+            return 0;
+        }
+
+        // The last indirect block is full, so start another one.
+        check(doubleIndirect->used < INDIRECTS_PER_BLOCK, SFS_ERR_FILE_FULL);
+        check_err(MapBlock_create(false, &created[0]));
+        indirect = created[0];
+    }
+    else if (file->indirectBlock >= 0) {
+        check_err(MapBlock_load(file->indirectBlock, false, &indirect));
+        if (append_to_extents(indirect->extents, EXTENTS_PER_BLOCK,
+                              last_extent(indirect->extents, indirect->used), block)) {
+            check_err(MapBlock_save(indirect));
+            return 0;
+        }
+
+        // The indirect block is full, so move on to the double indirect block.
+        check_err(MapBlock_create(true, &created[0]));
+        doubleIndirect = created[0];
+        check_err(MapBlock_create(false, &created[1]));
+        indirect = created[1];
+    }
+    else {
+        if (append_to_extents(file->extents, INODE_EXTENTS, last_extent(file->extents, INODE_EXTENTS), block)) {
+            return 0;
+        }
+
+        // The File's own extents are full, so move on to the indirect block.
+        check_err(MapBlock_create(false, &created[0]));
+        indirect = created[0];
+    }
+
+    // `indirect` is a brand new indirect block, so `block` is its first extent.
+    indirect->extents[0].start = block;
+    indirect->extents[0].length = 1;
+    check_err(MapBlock_save(indirect));
+
+    if (doubleIndirect) {
+        IndirectExtent *next = &doubleIndirect->indirects[doubleIndirect->used];
+        next->block = indirect->block;
+        next->length = 1;
+        check_err(MapBlock_save(doubleIndirect));
+        file->doubleIndirectBlock = doubleIndirect->block;
+    }
+    else {
+        file->indirectBlock = indirect->block;
+    }
+
+    return 0;
+
+error:
+    for (int i = 0; i < 2; i++) {
+        if (created[i]) {
+            MapBlock_discard(created[i]);
+        }
+    }
+    return err_code;
+}
+
+
+int File_get_goal(const File *file, BlockID *goal) {
+
+    int err_code = 0;
+    size_t blockCount = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    *goal = -1;
+
+    if (blockCount > 0 && !File_is_inline(file)) {
+        check_err(File_get_block(file, (unsigned int)(blockCount - 1), goal));
+        if (*goal >= 0) {
+            (*goal)++;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Reads an indirect block's extents into `extents`, which must hold EXTENTS_PER_BLOCK.
+ *
+ * The extents are copied so they remain valid while other map blocks are loaded.
+ */
+static int load_extents(BlockID block, Extent *extents, unsigned int *count) {
+
+    int err_code = 0;
+    MapBlock *mapBlock;
+
+    check_err(MapBlock_load(block, false, &mapBlock));
+    memcpy(extents, mapBlock->extents, sizeof(mapBlock->extents));
+    *count = mapBlock->used;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Calls `callback` on each extent in a list.
+ */
+static int walk_extents(const Extent *extents, size_t count,
+                        int (*callback)(BlockID, unsigned int, bool, void *), void *context) {
+
+    int err_code = 0;
+
+    for (size_t i = 0; i < count && extents[i].length > 0; i++) {
+        check_err(callback(extents[i].start, extents[i].length, false, context));
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_walk_blocks(const File *file,
+                     int (*callback)(BlockID start, unsigned int length, bool isMap, void *context),
+                     void *context) {
+
+    int err_code = 0;
+    Extent extents[EXTENTS_PER_BLOCK];
+    IndirectExtent indirects[INDIRECTS_PER_BLOCK];
+    unsigned int count;
+    MapBlock *mapBlock;
+
+    if (File_is_inline(file)) {
+        return 0;
+    }
+
+    check_err(walk_extents(file->extents, INODE_EXTENTS, callback, context));
+
+    if (file->indirectBlock >= 0) {
+        check_err(load_extents(file->indirectBlock, extents, &count));
+        check_err(callback(file->indirectBlock, 1, true, context));
+        check_err(walk_extents(extents, count, callback, context));
+    }
+
+    if (file->doubleIndirectBlock >= 0) {
+        check_err(MapBlock_load(file->doubleIndirectBlock, true, &mapBlock));
+        memcpy(indirects, mapBlock->indirects, sizeof(indirects));
+        count = mapBlock->used;
+        check_err(callback(file->doubleIndirectBlock, 1, true, context));
+
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int extentCount;
+            check_err(load_extents(indirects[i].block, extents, &extentCount));
+            check_err(callback(indirects[i].block, 1, true, context));
+            check_err(walk_extents(extents, extentCount, callback, context));
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Frees a run of blocks.
+ *
+ * They are zeroed once the journal commits the free (see Block_release_held).
+ */
+static int free_run(BlockID start, unsigned int length, bool isMap, void *context) {
+
+    for (unsigned int i = 0; i < length; i++) {
+        Block_free((BlockID)(start + i));
+    }
+
+    // A freed map block must not be found in the cache again.
+    if (isMap) {
+        for (int i = 0; i < MAP_CACHE_SIZE; i++) {
+            if (mapCache[i].block == start) {
+                mapCache[i].block = -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int File_free_blocks(File *file) {
+
+    int err_code = 0;
+
+    check_err(File_walk_blocks(file, free_run, NULL));
+
+    if (File_has_tail(file)) {
+        Fragment_free(file->tailBlock, file->tailFragment, File_tail_fragments(file));
+        file->flags &= ~FILE_TAIL;
+    }
+
+    if (!File_is_inline(file)) {
+        memset(file->extents, 0, sizeof(file->extents));
+        file->indirectBlock = -1;
+        file->doubleIndirectBlock = -1;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
@@ -25,6 +25,7 @@ int sfs_getsize(char *pathname) {
     int err_code = 0;
 
     File *file;
+    InodeCache_trim();
     check_err(File_find_by_path(&file, pathname));
 
     return (int)file->size;
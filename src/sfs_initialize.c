@@ -17,31 +17,149 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "dbg.h"
 #include "sfs_internal.h"
 #include "blockio.h"
 
-static void free_directory_lists(void) {
-    // For each file.
-    for (int i = 0; i < MAX_FILES; i++) {
-        File *file = &files[i];
-
-        // If it's a directory and has contents.
-        if (File_is_directory(file) && file->dirContents != NULL) {
-            FileNode *node = file->dirContents, *lastNode;
-            file->dirContents = NULL;
-
-            // Go through each node of the list and free them.
-            while (node) {
-                lastNode = node;
-                node = node->next;
-                free(lastNode);
-            }
-        }
+// Whether the file system was mounted successfully, so it has to be saved and marked as clean when it's unmounted.
+static bool mounted = false;
+
+
+static void shut_down(void) {
+    if (FileSystem_unmount(true) < 0) {
+        debug("Could not save the file system at exit, so the changes since its last commit are lost.");
     }
 }
 
-int sfs_initialize(int erase) {
+
+int FileSystemHeader_read(FileSystemHeader *header) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+
+    check(get_block(0, buffer) == 0, SFS_ERR_BLOCK_IO);
+    memcpy(header, buffer, sizeof(*header));
+
+    check(strcmp(header->magicCode1, MAGIC_CODE_1) == 0, SFS_ERR_INVALID_DATA_FILE);
+    check(header->version == SFS_DATA_VERSION, SFS_ERR_INVALID_DATA_FILE);
+    check(header->inodeSize == INODE_SIZE, SFS_ERR_INVALID_DATA_FILE);
+    check(header->blockSize == BLOCK_SIZE, SFS_ERR_INVALID_DATA_FILE);
+    check(header->maxBlocks == MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
+    check(header->inodeExtents == INODE_EXTENTS, SFS_ERR_INVALID_DATA_FILE);
+    check(header->inlineDataSize == INLINE_DATA_SIZE, SFS_ERR_INVALID_DATA_FILE);
+    check(header->fragmentSize == FRAGMENT_SIZE, SFS_ERR_INVALID_DATA_FILE);
+    check(header->maxPathComponentLength == MAX_PATH_COMPONENT_LENGTH, SFS_ERR_INVALID_DATA_FILE);
+    check(strcmp(header->magicCode2, MAGIC_CODE_2) == 0, SFS_ERR_INVALID_DATA_FILE);
+    check(header->commitMode <= COMMIT_LOG, SFS_ERR_INVALID_DATA_FILE);
+
+    commitMode = (CommitMode)header->commitMode;
+
+    // In copy-on-write mode, block 0 may not be where the last committed copy of the header is.
+    if (commitMode != COMMIT_JOURNAL) {
+        check_err(Shadow_load());
+        check_err(Journal_get_block(0, buffer));
+        memcpy(header, buffer, sizeof(*header));
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int FileSystemHeader_set_clean(bool clean) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+    unsigned int value = clean ? 1 : 0;
+
+    if (commitMode != COMMIT_JOURNAL) {
+        return 0;
+    }
+
+    // Only the one field is changed, so the header is updated in place.
+    check(get_block(0, buffer) == 0, SFS_ERR_BLOCK_IO);
+    memcpy(buffer + offsetof(FileSystemHeader, clean), &value, sizeof(value));
+    check(put_block(0, buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Loads which blocks are in use and the inode table, and ensures that the first File is the root directory.
+ */
+static int load(const FileSystemHeader *header) {
+
+    int err_code = 0;
+
+    check_err(Bitmap_load());
+    check_err(InodeTable_load(header->inodeTable));
+
+    File *root = File_get(0);
+    check(File_is_directory(root), SFS_ERR_INVALID_DATA_FILE);
+    check(strcmp(root->name, "/") == 0, SFS_ERR_INVALID_DATA_FILE);
+    check(root->parentDirectoryID == FILE_ID_NONE, SFS_ERR_INVALID_DATA_FILE);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int FileSystem_unmount(bool save) {
+
+    int err_code = 0;
+
+    // Everything has to be on the device before the file system is marked as clean.
+    // If it can't be, the file system stays mounted, so that nothing is lost.
+    if (save && mounted) {
+        check_err(PendingData_flush_all());
+        check_err(Journal_stop());
+        check_err(FileSystemHeader_set_clean(true));
+    }
+    mounted = false;
+    readOnly = false;
+
+    // Whatever wasn't committed is lost.
+    Journal_discard();
+    Block_forget_held();
+
+    PendingData_discard(NULL);
+    InodeTable_free();
+
+    // The Files that were open are gone.
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        openFiles[i].file = NULL;
+        openFiles[i].lastRead = FILE_ID_NONE;
+    }
+
+    // Anything cached from the last time the device was loaded is stale.
+    MapCache_clear();
+    DentryCache_clear();
+    Reservation_release(NULL);
+
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+        freeBlocks[i] = true;
+        usedFragments[i] = 0;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int FileSystem_initialize(bool erase, CommitMode mode) {
 
     int err_code = 0;
     char buffer[BLOCK_SIZE];
@@ -50,228 +168,154 @@ int sfs_initialize(int erase) {
     // First, check some assumptions that should hold true.
     // These should ideally be checked at compile-time, but C compilers don't have static assertions.
     {
-        const size_t fileSize = sizeof(File),
-            filesPerBlock = BLOCK_SIZE/fileSize;
-
-        // Compute the number of blocks needed to store all the File objects.
-        size_t fileBlocks = MAX_FILES/filesPerBlock;
-        // If there was remainder, add an extra block for them.
-        if (MAX_FILES % filesPerBlock != 0) {
-            fileBlocks++;
-        }
-
         // All error codes should be negative.
         check(SFS_ERR_MAX <= 0, SFS_ERR_ADJUST_ERROR_CODES);
-        // We need enough blocks to store the header and all the Files.
-        check(fileBlocks < MAX_BLOCKS-1, SFS_ERR_NOT_ENOUGH_BLOCKS_FOR_FILES);
+        // We need enough blocks to store the header, the allocation bitmap, the journal and the first chunk of Files.
+        check(FIRST_DATA_BLOCK + INODE_CHUNK_BLOCKS < MAX_BLOCKS, SFS_ERR_NOT_ENOUGH_BLOCKS_FOR_FILES);
         // There should be enough room in a block to hold at least one File object.
-        check(BLOCK_SIZE >= sizeof(File), SFS_ERR_BLOCKS_TOO_SMALL_FOR_FILE);
+        check(BLOCK_SIZE >= INODE_SIZE, SFS_ERR_BLOCKS_TOO_SMALL_FOR_FILE);
     }
 
-    // If initialize is called twice, memory could be leaked.
-    // This will clean up any FileNodes that already exist.
-    if (initialized) {
-        free_directory_lists();
-    }
-    else {
-        // Free directory list memory at exit.
-        atexit(free_directory_lists);
+    if (!initialized) {
+        // Unmount the file system cleanly at exit.
+        atexit(shut_down);
     }
     initialized = true;
 
-    // Mark all blocks as free at the start.
-    for (int i = 0; i < MAX_BLOCKS; i++) {
-        freeBlocks[i] = true;
-    }
+    // If initialize is called twice, memory could be leaked.
+    // This will unmount the file system that's already loaded, and clean up any Files and directory indexes that exist.
+    // Pending data belongs on the device being reloaded, unless it's about to be erased anyway.
+    check_err(FileSystem_unmount(!erase));
 
     // 1. Load the first page (header) of the file system into a buffer.
     check(get_block(0, buffer) == 0, SFS_ERR_BLOCK_IO);
-    freeBlocks[0] = false;
 
     // A filesystem already exists and we don't want to erase it.
     if (buffer[0] > 0 && !erase) {
         // a. Ensure that all the header’s fields are valid.
-        memcpy(&header, buffer, sizeof(header));
-
-        check(strcmp(header.magicCode1, MAGIC_CODE_1) == 0, SFS_ERR_INVALID_DATA_FILE);
-        check(header.version == SFS_DATA_VERSION, SFS_ERR_INVALID_DATA_FILE);
-        check(header.fileControlBlockSize == sizeof(File), SFS_ERR_INVALID_DATA_FILE);
-        check(header.blockSize == BLOCK_SIZE, SFS_ERR_INVALID_DATA_FILE);
-        check(header.maxBlocks == MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
-        check(header.maxFiles == MAX_FILES, SFS_ERR_INVALID_DATA_FILE);
-        check(header.maxBlocksPerFile == MAX_BLOCKS_PER_FILE, SFS_ERR_INVALID_DATA_FILE);
-        check(header.maxPathComponentLength == MAX_PATH_COMPONENT_LENGTH, SFS_ERR_INVALID_DATA_FILE);
-        check(strcmp(header.magicCode2, MAGIC_CODE_2) == 0, SFS_ERR_INVALID_DATA_FILE);
-
-        // b. Load all of the Files into memory from the reserved File blocks.
-        BlockID currentBlock = 0;
-
-        for (FileID file_id = 0; file_id < MAX_FILES; file_id++) {
-            BlockID block_id = FileID_to_BlockID(file_id);
-            unsigned char offset = FileID_to_offset(file_id);
-
-            if (block_id != currentBlock) {
-                check(get_block(block_id, buffer) == 0, SFS_ERR_BLOCK_IO);
-                freeBlocks[block_id] = false;
-                currentBlock = block_id;
-            }
-
-            memcpy(&files[file_id], buffer+offset, sizeof(File));
+        check_err(FileSystemHeader_read(&header));
+
+        // b. If the file system wasn't unmounted cleanly, make sure the last transaction committed
+        //    to the journal made it to the device, so that it is consistent again.
+        //    Nothing else is checked here, since sfs_fsck checks the whole file system when it needs to be.
+        if (!header.clean) {
+            check_err(Journal_recover());
+            check_err(FileSystemHeader_read(&header));
         }
 
-        // d. Ensure that the first File is the root directory.
-        File *root = &files[0];
-        check(File_is_directory(root), SFS_ERR_INVALID_DATA_FILE);
-        check(strcmp(root->name, "/") == 0, SFS_ERR_INVALID_DATA_FILE);
-        check(root->parentDirectoryID == -1, SFS_ERR_INVALID_DATA_FILE);
-
-        // e. For each File
-        for (FileID file_id = 0; file_id < MAX_FILES; file_id++) {
-            File *file = &files[file_id];
-
-            // i. Ensure that the type is valid.
-            check(file->type == FTYPE_NONE || File_is_data(file) || File_is_directory(file), SFS_ERR_INVALID_DATA_FILE);
-
-            // ii. Ensure that the parent exists and is a directory.
-            File *parent = File_get_parent(file);
-            if (parent) {
-                // Make sure the parent is a directory.
-                check(File_is_directory(parent), SFS_ERR_INVALID_DATA_FILE);
-                // Make sure the parent isn't this file.
-                check(parent != file, SFS_ERR_INVALID_DATA_FILE);
-            }
-            else {
-                // The only active file without a parent is the root directory.
-                check(file_id == 0 || file->type == FTYPE_NONE, SFS_ERR_INVALID_DATA_FILE);
-            }
+        // c. Load which blocks are in use and the inode table, and ensure that the first File is the root directory.
+        check_err(load(&header));
 
-            // iii. If the File is a data file
-            if (File_is_data(file)) {
-                // 1. Ensure that the File’s size is consistent with the number of blocks it is using.
-                unsigned char blocksInUse = 0;
-                for (int i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
-                    if (file->blocks[i] >= 0) {
-                        blocksInUse++;
-                    }
-                    // As soon as we hit a -1, the rest should also be -1, so break.
-                    else {
-                        break;
-                    }
-                }
-
-                if (blocksInUse == 0) {
-                    check(file->size == 0, SFS_ERR_INVALID_DATA_FILE);
-                }
-                else {
-                    check((file->size)/BLOCK_SIZE+1 == blocksInUse, SFS_ERR_INVALID_DATA_FILE);
-                }
-
-                // 2. For each block, ensure that the block is unused and mark it at used.
-                for (int i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
-                    BlockID block_id = file->blocks[i];
-                    if (block_id >= 0) {
-                        check(freeBlocks[block_id], SFS_ERR_INVALID_DATA_FILE);
-                        freeBlocks[block_id] = false;
-                    }
-                }
-            }
-            // iv. If the File is a directory
-            else if (File_is_directory(file)) {
-                File *directory = file;
-                directory->dirContents = NULL;
-
-                // 1. For each File, if the File’s parent is this File, add that File to this File’s list of contents.
-                for (FileID file_id_2 = 0; file_id_2 < MAX_FILES; file_id_2++) {
-                    // A directory can't contain itself, so skip the directory.
-                    if (file_id_2 == file_id) {
-                        continue;
-                    }
-
-                    file = &files[file_id_2];
-
-                    if (file->parentDirectoryID == file_id) {
-                        File_add_file_to_dir(file, directory);
-                    }
-                }
-
-                // 2. Ensure that the File’s size is consistent with the number of items in its list of contents.
-                if (directory->dirContents == NULL) {
-                    check(directory->size == 0, SFS_ERR_INVALID_DATA_FILE);
-                }
-                else {
-                    FileNode *node = directory->dirContents;
-                    unsigned char directorySize = 1;
-
-                    while (node->next != NULL) {
-                        node = node->next;
-                        directorySize++;
-                    }
-
-                    check(directory->size == directorySize, SFS_ERR_INVALID_DATA_FILE);
-                }
-            }
-        }
+        // d. The file system isn't clean again until it's unmounted, and changes go through the journal until then.
+        check_err(FileSystemHeader_set_clean(false));
+        check_err(Journal_start(true));
     }
     // The filesystem needs to be created from scratch.
     else {
-        // a. Create the root directory file as File 0.
-        File *root = &files[0];
-        root->type = FTYPE_DIR;
-        root->name[0] = '/';
-        root->name[1] = '\0';
-        root->size = 0;
-        root->dirContents = NULL;
-        root->parentDirectoryID = -1;
-        check_err(File_save(root));
-
-        // b. Save the header to block 0 and the root directory to block 1.
+        // a. Save the header to block 0.
+        //    With a journal it isn't clean until it's unmounted, since the allocation bitmap isn't saved until then.
+        memset(&header, 0, sizeof(header));
         strcpy(header.magicCode1, MAGIC_CODE_1);
         strcpy(header.magicCode2, MAGIC_CODE_2);
         header.version = SFS_DATA_VERSION;
         header.blockSize = BLOCK_SIZE;
-        header.fileControlBlockSize = sizeof(File);
+        header.inodeSize = INODE_SIZE;
         header.maxBlocks = MAX_BLOCKS;
-        header.maxBlocksPerFile = MAX_BLOCKS_PER_FILE;
-        header.maxFiles = MAX_FILES;
+        header.inodeExtents = INODE_EXTENTS;
+        header.inlineDataSize = INLINE_DATA_SIZE;
+        header.fragmentSize = FRAGMENT_SIZE;
         header.maxPathComponentLength = MAX_PATH_COMPONENT_LENGTH;
+        header.clean = mode == COMMIT_JOURNAL ? 0 : 1;
+        header.commitMode = mode;
+        commitMode = mode;
 
         memset(buffer, 0, sizeof(buffer));
         memcpy(buffer, &header, sizeof(header));
         check(put_block(0, buffer) == 0, SFS_ERR_BLOCK_IO);
 
-        memset(buffer, 0, sizeof(buffer));
-        memcpy(buffer, root, sizeof(*root));
-        check(put_block(1, buffer) == 0, SFS_ERR_BLOCK_IO);
-
-        // c. If erase is 1, overwrite all the other blocks with a buffer filled with zeros.
+        // b. If erase is 1, overwrite all the other blocks with a buffer filled with zeros.
         if (erase) {
             memset(buffer, 0, sizeof(buffer));
 
-            for (int i = 2; i < MAX_BLOCKS; i++) {
+            for (int i = 1; i < MAX_BLOCKS; i++) {
                 check(put_block(i, buffer) == 0, SFS_ERR_BLOCK_IO);
             }
         }
 
-        // Initialize all the other files.
-        for (int i = 1; i < MAX_FILES; i++) {
-            File *file = &files[i];
-            memset(file, 0, sizeof(*file));
-            file->parentDirectoryID = -1;
-            file->type = FTYPE_NONE;
-            check_err(File_save(file));
-            freeBlocks[FileID_to_BlockID(i)] = false;
+        // c. The header, the allocation bitmap and the journal are always in use.
+        for (int i = 0; i < FIRST_DATA_BLOCK; i++) {
+            freeBlocks[i] = false;
         }
 
-        // Initialize the OpenFiles.
-        for (int i = 0; i < MAX_OPEN_FILES; i++) {
-            OpenFile *openFile = &openFiles[i];
-            openFile->file = NULL;
-            openFile->lastRead = NULL;
+        // d. Start with an empty journal, or with every block at home.
+        if (mode != COMMIT_JOURNAL) {
+            check_err(Shadow_format());
         }
+        else {
+            check_err(Journal_format());
+        }
+        check_err(Journal_start(false));
+
+        // e. Create an inode table with the first chunk of empty Files.
+        check_err(InodeTable_create());
+
+        // f. Create the root directory file as File 0, and commit the new file system.
+        File *root = File_get(0);
+        root->type = FTYPE_DIR;
+        root->name[0] = '/';
+        root->name[1] = '\0';
+        root->size = 0;
+        root->dirIndex = NULL;
+        root->parentDirectoryID = FILE_ID_NONE;
+        check_err(File_save(root));
+        check_err(Journal_commit());
     }
 
+    mounted = true;
+    InodeCache_trim();
+
     return 0;
 
 error:
     return err_code;
 }
+
+
+int FileSystem_mount_snapshot(int snapshot) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+    FileSystemHeader header;
+
+    // The live file system is left mounted if it can't be saved, rather than thrown away below.
+    int saved = FileSystem_unmount(true);
+    if (saved < 0) {
+        return saved;
+    }
+
+    // 1. Ensure that the header is valid, and that the file system can have snapshots.
+    check_err(FileSystemHeader_read(&header));
+    check(commitMode != COMMIT_JOURNAL, SFS_ERR_INVALID_MODE);
+
+    // 2. From now on, blocks are read as they were when the snapshot was taken, starting with the header.
+    check_err(Shadow_load_snapshot(snapshot));
+    check_err(Journal_get_block(0, buffer));
+    memcpy(&header, buffer, sizeof(header));
+
+    // 3. Load the snapshot's Files. Nothing is ever written, so the journal isn't started.
+    check_err(load(&header));
+    readOnly = true;
+
+    InodeCache_trim();
+
+    return 0;
+
+error:
+    FileSystem_unmount(false);
+    return err_code;
+}
+
+
+int sfs_initialize(int erase) {
+    return FileSystem_initialize(erase != 0, COMMIT_JOURNAL);
+}
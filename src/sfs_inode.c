@@ -0,0 +1,589 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+File inodeTable;
+DirEntry *dirEntries = NULL;
+
+// The number of entries in `dirEntries`.
+static FileID dirEntryCount = 0;
+
+
+/*
+ * CachedFile - A File that has been loaded into memory.
+ *
+ * Each one is allocated separately from `cachedFilePool`, so that Files don't move while they are in memory.
+ */
+typedef struct sCachedFile {
+    // Must be the first member, so that a File in memory can be turned back into its CachedFile.
+    File file;
+
+    // The next CachedFile in the same hash bucket, or NULL if this is the last.
+    struct sCachedFile *hashNext;
+
+    // The CachedFiles used just after and just before this one, or NULL at either end of the list.
+    struct sCachedFile *newer;
+    struct sCachedFile *older;
+
+} CachedFile;
+
+// The CachedFiles, hashed by their File's ID.
+static CachedFile *buckets[INODE_CACHE_BUCKETS];
+
+// The ends of the list of CachedFiles, from most to least recently used.
+static CachedFile *newest = NULL, *oldest = NULL;
+
+// The number of CachedFiles.
+static unsigned int cachedCount = 0;
+
+// Where CachedFiles are allocated, a cache's worth of them at a time.
+static Pool cachedFilePool = POOL_INIT(sizeof(CachedFile), INODE_CACHE_SIZE);
+
+
+/*
+ * The on-disk inode is INODE_SIZE bytes, with every field little-endian:
+ *
+ *   0   type                  1 byte
+ *   1   flags                 1 byte
+ *   2   name                  INODE_NAME_LENGTH bytes, either:
+ *         - the name, zero padded, no terminator
+ *         - nameFirst (4), nameLength (1), if the File has the FILE_LONG_NAME flag
+ *   8   parentDirectoryID     4 bytes, FILE_ID_NONE for none
+ *   12  size                  4 bytes
+ *   16  contents              16 bytes, either:
+ *         - the inline data, if the File has the FILE_INLINE flag
+ *         - indirectBlock (2), doubleIndirectBlock (2), extents (4 each: start, length),
+ *           tailBlock (2), tailFragment (1)
+ *         - zeroes, for directories and unused Files
+ *
+ * A NAME file holds part of a long name instead:
+ *
+ *   0   type                  1 byte
+ *   1   flags                 1 byte, always zero
+ *   2   nameNext              4 bytes, FILE_ID_NONE for none
+ *   6   namePart              NAME_PART_LENGTH bytes, zero padded, no terminator
+ */
+#define INODE_NAME_OFFSET 2
+#define INODE_NAME_PART_OFFSET 6
+#define INODE_PARENT_OFFSET 8
+#define INODE_SIZE_OFFSET 12
+#define INODE_CONTENTS_OFFSET 16
+#define INODE_EXTENTS_OFFSET (INODE_CONTENTS_OFFSET + 4)
+#define INODE_TAIL_OFFSET (INODE_EXTENTS_OFFSET + 4 * INODE_EXTENTS)
+
+
+static void put_u16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    put_u16(buffer, (uint16_t)value);
+    put_u16(buffer + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *buffer) {
+    return (uint16_t)(buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buffer) {
+    return get_u16(buffer) | (uint32_t)get_u16(buffer + 2) << 16;
+}
+
+
+void File_encode(const File *file, uint8_t *buffer) {
+
+    memset(buffer, 0, INODE_SIZE);
+
+    buffer[0] = (uint8_t)file->type;
+    buffer[1] = file->flags;
+
+    if (file->type == FTYPE_NAME) {
+        put_u32(buffer + INODE_NAME_OFFSET, file->nameNext);
+        memcpy(buffer + INODE_NAME_PART_OFFSET, file->namePart, NAME_PART_LENGTH);
+        return;
+    }
+
+    if (file->flags & FILE_LONG_NAME) {
+        put_u32(buffer + INODE_NAME_OFFSET, file->nameFirst);
+        buffer[INODE_NAME_OFFSET + 4] = file->nameLength;
+    }
+    else {
+        strncpy((char *)buffer + INODE_NAME_OFFSET, file->name, INODE_NAME_LENGTH);
+    }
+    put_u32(buffer + INODE_PARENT_OFFSET, file->parentDirectoryID);
+    put_u32(buffer + INODE_SIZE_OFFSET, (uint32_t)file->size);
+
+    // Directories' contents are rebuilt at load, so there is nothing else to store for them.
+    if (!File_is_data(file)) {
+        return;
+    }
+
+    if (File_is_inline(file)) {
+        memcpy(buffer + INODE_CONTENTS_OFFSET, file->inlineData, INLINE_DATA_SIZE);
+        return;
+    }
+
+    put_u16(buffer + INODE_CONTENTS_OFFSET, (uint16_t)file->indirectBlock);
+    put_u16(buffer + INODE_CONTENTS_OFFSET + 2, (uint16_t)file->doubleIndirectBlock);
+
+    for (int i = 0; i < INODE_EXTENTS; i++) {
+        put_u16(buffer + INODE_EXTENTS_OFFSET + 4*i, (uint16_t)file->extents[i].start);
+        put_u16(buffer + INODE_EXTENTS_OFFSET + 4*i + 2, file->extents[i].length);
+    }
+
+    put_u16(buffer + INODE_TAIL_OFFSET, (uint16_t)file->tailBlock);
+    buffer[INODE_TAIL_OFFSET + 2] = file->tailFragment;
+}
+
+
+void File_decode(File *file, const uint8_t *buffer) {
+
+    memset(file, 0, sizeof(*file));
+
+    file->type = (FileType)buffer[0];
+    file->flags = buffer[1];
+
+    if (file->type == FTYPE_NAME) {
+        file->nameNext = get_u32(buffer + INODE_NAME_OFFSET);
+        memcpy(file->namePart, buffer + INODE_NAME_PART_OFFSET, NAME_PART_LENGTH);
+        file->parentDirectoryID = FILE_ID_NONE;
+        return;
+    }
+
+    if (file->flags & FILE_LONG_NAME) {
+        file->nameFirst = get_u32(buffer + INODE_NAME_OFFSET);
+        file->nameLength = buffer[INODE_NAME_OFFSET + 4];
+    }
+    else {
+        memcpy(file->name, buffer + INODE_NAME_OFFSET, INODE_NAME_LENGTH);
+    }
+    file->parentDirectoryID = get_u32(buffer + INODE_PARENT_OFFSET);
+    file->size = get_u32(buffer + INODE_SIZE_OFFSET);
+
+    if (!File_is_data(file)) {
+        file->dirIndex = NULL;
+        return;
+    }
+
+    if (File_is_inline(file)) {
+        memcpy(file->inlineData, buffer + INODE_CONTENTS_OFFSET, INLINE_DATA_SIZE);
+        return;
+    }
+
+    file->indirectBlock = (BlockID)get_u16(buffer + INODE_CONTENTS_OFFSET);
+    file->doubleIndirectBlock = (BlockID)get_u16(buffer + INODE_CONTENTS_OFFSET + 2);
+
+    for (int i = 0; i < INODE_EXTENTS; i++) {
+        file->extents[i].start = (BlockID)get_u16(buffer + INODE_EXTENTS_OFFSET + 4*i);
+        file->extents[i].length = get_u16(buffer + INODE_EXTENTS_OFFSET + 4*i + 2);
+    }
+
+    file->tailBlock = (BlockID)get_u16(buffer + INODE_TAIL_OFFSET);
+    file->tailFragment = buffer[INODE_TAIL_OFFSET + 2];
+}
+
+
+/*
+ * Finds the File with ID `id` if it is in memory, otherwise NULL.
+ */
+static CachedFile * InodeCache_find(FileID id) {
+
+    for (CachedFile *entry = buckets[id % INODE_CACHE_BUCKETS]; entry != NULL; entry = entry->hashNext) {
+        if (entry->file.id == id) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Takes `entry` out of the list of CachedFiles.
+ */
+static void InodeCache_unlink(CachedFile *entry) {
+
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        newest = entry->older;
+    }
+
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        oldest = entry->newer;
+    }
+}
+
+
+/*
+ * Puts `entry` at the most recently used end of the list of CachedFiles.
+ */
+static void InodeCache_link(CachedFile *entry) {
+
+    entry->older = newest;
+    entry->newer = NULL;
+
+    if (newest) {
+        newest->newer = entry;
+    }
+    else {
+        oldest = entry;
+    }
+    newest = entry;
+}
+
+
+/*
+ * Forgets `entry` and frees it.
+ */
+static void InodeCache_remove(CachedFile *entry) {
+
+    CachedFile **link = &buckets[entry->file.id % INODE_CACHE_BUCKETS];
+
+    while (*link != entry) {
+        link = &(*link)->hashNext;
+    }
+    *link = entry->hashNext;
+
+    InodeCache_unlink(entry);
+    Pool_free(&cachedFilePool, entry);
+    cachedCount--;
+}
+
+
+/*
+ * Loads the Files in block `index` of the inode table that aren't already in memory.
+ */
+static int InodeCache_load_block(unsigned int index) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+    BlockID block;
+
+    check_err(File_get_block(&inodeTable, index, &block));
+    check(block >= 0, SFS_ERR_INVALID_DATA_FILE);
+    check_err(Journal_get_block(block, buffer));
+
+    for (unsigned int i = 0; i < INODES_PER_BLOCK; i++) {
+        FileID id = index * INODES_PER_BLOCK + i;
+
+        if (InodeCache_find(id)) {
+            continue;
+        }
+
+        CachedFile *entry = Pool_alloc(&cachedFilePool);
+        check_mem(entry);
+
+        File_decode(&entry->file, (uint8_t *)buffer + i * INODE_SIZE);
+        entry->file.id = id;
+
+        entry->hashNext = buckets[id % INODE_CACHE_BUCKETS];
+        buckets[id % INODE_CACHE_BUCKETS] = entry;
+        InodeCache_link(entry);
+        cachedCount++;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+File * File_get(FileID id) {
+
+    if (id >= File_count()) {
+        return NULL;
+    }
+
+    CachedFile *entry = InodeCache_find(id);
+
+    if (!entry) {
+        if (InodeCache_load_block(FileID_to_table_block(id)) < 0) {
+            return NULL;
+        }
+        entry = InodeCache_find(id);
+    }
+
+    // Move it to the most recently used end.
+    InodeCache_unlink(entry);
+    InodeCache_link(entry);
+
+    return &entry->file;
+}
+
+
+/*
+ * Returns `true` if `file` must stay in memory, because something refers to it or to memory it owns.
+ */
+static bool is_in_use(const File *file) {
+
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (openFiles[i].file == file) {
+            return true;
+        }
+    }
+
+    return PendingData_find(file) != NULL || (File_is_directory(file) && file->dirIndex != NULL);
+}
+
+
+void InodeCache_trim(void) {
+
+    CachedFile *entry = oldest;
+
+    while (cachedCount > INODE_CACHE_SIZE && entry != NULL) {
+        CachedFile *newer = entry->newer;
+
+        if (!is_in_use(&entry->file)) {
+            InodeCache_remove(entry);
+        }
+
+        entry = newer;
+    }
+}
+
+
+int InodeTable_read_block(unsigned int index, File *files) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+    BlockID block;
+
+    check_err(File_get_block(&inodeTable, index, &block));
+    check(block >= 0, SFS_ERR_INVALID_DATA_FILE);
+    check_err(Journal_get_block(block, buffer));
+
+    for (unsigned int i = 0; i < INODES_PER_BLOCK; i++) {
+        FileID id = index * INODES_PER_BLOCK + i;
+        CachedFile *entry = InodeCache_find(id);
+
+        if (entry) {
+            files[i] = entry->file;
+        }
+        else {
+            File_decode(&files[i], (uint8_t *)buffer + i * INODE_SIZE);
+            files[i].id = id;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+File * File_find_empty() {
+
+    // Start looking in the block of the last empty File found, since the ones before it were probably taken.
+    static FileID hint = 0;
+    FileID count = File_count();
+    unsigned int blocks = FileID_to_table_block(count);
+    File block[INODES_PER_BLOCK];
+
+    for (unsigned int i = 0; i < blocks; i++) {
+        unsigned int index = (FileID_to_table_block(hint) + i) % blocks;
+
+        // The Files are only looked at, so they aren't loaded into memory unless one is picked.
+        if (InodeTable_read_block(index, block) < 0) {
+            return NULL;
+        }
+
+        for (unsigned int j = 0; j < INODES_PER_BLOCK; j++) {
+            if (block[j].type == FTYPE_NONE) {
+                hint = block[j].id;
+                return File_get(hint);
+            }
+        }
+    }
+
+    // Every File is in use, so make room for more.
+    if (InodeTable_grow() < 0) {
+        return NULL;
+    }
+
+    hint = count;
+    return File_get(count);
+}
+
+
+/*
+ * Writes the inode table into the header.
+ */
+static int InodeTable_save(void) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+
+    check_err(Journal_get_block(0, buffer));
+    File_encode(&inodeTable, (uint8_t *)buffer + offsetof(FileSystemHeader, inodeTable));
+    check_err(Journal_put_block(0, buffer));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int InodeTable_create(void) {
+
+    InodeTable_free();
+
+    inodeTable.type = FTYPE_DATA;
+    inodeTable.parentDirectoryID = FILE_ID_NONE;
+    inodeTable.indirectBlock = -1;
+    inodeTable.doubleIndirectBlock = -1;
+    inodeTable.id = FILE_ID_NONE;
+
+    return InodeTable_grow();
+}
+
+
+int InodeTable_grow(void) {
+
+    int err_code = 0;
+    char zeroes[INODE_CHUNK_BLOCKS * BLOCK_SIZE];
+    BlockID goal, start;
+    unsigned int length, appended = 0;
+
+    // Grow to the end of the chunk, in case an earlier call only managed part of it.
+    unsigned int want = INODE_CHUNK_BLOCKS - FileID_to_table_block(File_count()) % INODE_CHUNK_BLOCKS;
+
+    // The new Files are all empty, which is what zeroed blocks decode to.
+    memset(zeroes, 0, sizeof(zeroes));
+
+    check_err(File_get_goal(&inodeTable, &goal));
+    check_err(Block_allocate_near(&inodeTable, goal, want, &start, &length));
+    Reservation_release(&inodeTable);
+
+    if (put_blocks(start, (int)length, zeroes) != 0) {
+        err_code = SFS_ERR_BLOCK_IO;
+    }
+
+    for (; err_code == 0 && appended < length; appended++) {
+        err_code = File_append_block(&inodeTable, (BlockID)(start + appended));
+    }
+
+    // Give back whatever didn't make it into the table.
+    for (unsigned int i = appended; i < length; i++) {
+        freeBlocks[start + i] = true;
+    }
+
+    if (appended > 0) {
+        inodeTable.size += appended * BLOCK_SIZE;
+        check_err(InodeTable_save());
+    }
+    check_err(err_code);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int InodeTable_load(const uint8_t *encoded) {
+
+    int err_code = 0;
+
+    InodeTable_free();
+    File_decode(&inodeTable, encoded);
+    inodeTable.id = FILE_ID_NONE;
+
+    // The table is a plain data file made of whole blocks.
+    check(File_is_data(&inodeTable), SFS_ERR_INVALID_DATA_FILE);
+    check(inodeTable.flags == 0, SFS_ERR_INVALID_DATA_FILE);
+    check(inodeTable.size > 0 && inodeTable.size % BLOCK_SIZE == 0, SFS_ERR_INVALID_DATA_FILE);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+void InodeTable_free(void) {
+
+    // Only the larger directory indexes were allocated on their own. Everything else is freed along with its Pool.
+    for (CachedFile *entry = oldest; entry != NULL; entry = entry->newer) {
+        if (File_is_directory(&entry->file)) {
+            File_free_contents(&entry->file);
+        }
+    }
+
+    Pool_release(&cachedFilePool);
+    Pool_release(&dirIndexPool);
+    memset(buckets, 0, sizeof(buckets));
+    newest = NULL;
+    oldest = NULL;
+    cachedCount = 0;
+
+    free(dirEntries);
+    dirEntries = NULL;
+    dirEntryCount = 0;
+
+    memset(&inodeTable, 0, sizeof(inodeTable));
+}
+
+
+int DirEntries_reserve(void) {
+
+    int err_code = 0;
+    FileID count = File_count();
+
+    if (count <= dirEntryCount) {
+        return 0;
+    }
+
+    DirEntry *entries = realloc(dirEntries, count * sizeof(DirEntry));
+    check_mem(entries);
+
+    // The new Files aren't in any directory yet.
+    for (FileID id = dirEntryCount; id < count; id++) {
+        entries[id].next = FILE_ID_NONE;
+        entries[id].prev = FILE_ID_NONE;
+        entries[id].generation = 0;
+        entries[id].hash = 0;
+        entries[id].length = 0;
+        entries[id].nameOffset = 0;
+    }
+
+    dirEntries = entries;
+    dirEntryCount = count;
+    return 0;
+
+error:
+    return err_code;
+}
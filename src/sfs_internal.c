@@ -26,63 +26,127 @@
 #include "sfs_internal.h"
 
 
-File files[MAX_FILES];
 OpenFile openFiles[MAX_OPEN_FILES];
 bool freeBlocks[MAX_BLOCKS];
+uint8_t usedFragments[MAX_BLOCKS];
 bool initialized = false;
+CommitMode commitMode = COMMIT_JOURNAL;
+bool readOnly = false;
+Pool dirIndexPool = POOL_INIT(sizeof(DirIndex) + 2 * DIR_INDEX_MIN_CAPACITY * sizeof(FileID), 16);
 
 
-File * File_find_empty() {
+/*
+ * Walks the path from the root directory, finding each component in the directory before it.
+ *
+ * If `toParent` is true, the walk stops when it gets to the last component,
+ *   and the directory that it would be in is found instead.
+ */
+static int walk_path(File **_file, PathIterator *iterator, bool toParent) {
+
+    int err_code = 0;
+    File *file = File_get(0);
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].type == FTYPE_NONE) {
-            return &files[i];
+    while ((err_code = PathIterator_next(iterator)) > 0) {
+        check(File_is_directory(file), SFS_ERR_BAD_FILE_TYPE);
+
+        if (toParent && PathIterator_is_last(iterator)) {
+            *_file = file;
+            return 0;
         }
+
+        check_err(File_load_contents(file));
+        file = File_find_component_in_dir(iterator->component, iterator->length, file);
+        check(file != NULL, SFS_ERR_FILE_NOT_FOUND);
     }
+    check_err(err_code);
 
-    return NULL;
+    // Only the root directory has no components, and it has no parent.
+    check(!toParent, SFS_ERR_INVALID_PATH);
+
+    *_file = file;
+    return 0;
+
+error:
+    return err_code;
 }
 
 
 int File_find_by_path(File **_file, const char *path) {
 
     int err_code = 0;
-    char **tokens = NULL;
+    PathIterator iterator;
     File *file = NULL;
+    FileID id;
+    size_t length = strlen(path);
     *_file = NULL;
 
-    // Split the path into tokens.
-    check_err(path_to_tokens(path, &tokens));
+    // A path that was looked up recently doesn't need to be walked again.
+    if (DentryCache_lookup(path, length, &id)) {
+        if (id == FILE_ID_NONE) {
+            return SFS_ERR_FILE_NOT_FOUND;
+        }
 
-    // Start at the root directory;
-    File *directory = &files[0];
-    file = directory;
+        file = File_get(id);
+        if (file) {
+            *_file = file;
+            return 0;
+        }
+    }
 
-    // For each token, find the file in `directory`, updating `directory` as we traverse the path.
-    for (int i = 0; tokens[i] != NULL; i++) {
-        char *token = tokens[i];
+    check_err(PathIterator_start(&iterator, path));
+    check_err(walk_path(&file, &iterator, false));
 
-        File *next = File_find_in_dir(token, directory);
-        check(next != NULL, SFS_ERR_FILE_NOT_FOUND);
+    DentryCache_insert(path, length, File_get_id(file));
+    *_file = file;
+    return 0;
 
-        // If next token is NULL, this is the last token.
-        if (tokens[i+1] == NULL) {
-            file = next;
-        }
-        else {
-            check(File_is_directory(next), SFS_ERR_BAD_FILE_TYPE);
-            directory = next;
+error:
+    err_code = PathIterator_finish(&iterator, err_code);
+    if (err_code == SFS_ERR_FILE_NOT_FOUND) {
+        DentryCache_insert(path, length, FILE_ID_NONE);
+    }
+    return err_code;
+}
+
+
+int File_find_parent_by_path(File **_parent, PathIterator *iterator, const char *path) {
+
+    int err_code = 0;
+    File *parent = NULL;
+    FileID id;
+    *_parent = NULL;
+
+    check_err(PathIterator_start(iterator, path));
+
+    // The parent's path is everything before the last '/', unless that's the root directory's.
+    const char *last = strrchr(path, '/');
+    size_t length = last != NULL ? (size_t)(last - path) : 0;
+
+    if (length > 0 && DentryCache_lookup(path, length, &id)) {
+        check(id != FILE_ID_NONE, SFS_ERR_FILE_NOT_FOUND);
+        parent = File_get(id);
+    }
+
+    if (parent) {
+        // Skip straight to the last component.
+        iterator->rest = last;
+        check_err(PathIterator_next(iterator));
+        check(File_is_directory(parent), SFS_ERR_BAD_FILE_TYPE);
+    }
+    else {
+        check_err(walk_path(&parent, iterator, true));
+        if (length > 0) {
+            DentryCache_insert(path, length, File_get_id(parent));
         }
     }
 
-    // Prevent memory leaks.
-    free_tokens(&tokens);
-    *_file = file;
+    check_err(File_load_contents(parent));
+
+    *_parent = parent;
     return 0;
 
 error:
-    free_tokens(&tokens);
-    return err_code;
+    return PathIterator_finish(iterator, err_code);
 }
 
 
@@ -98,29 +162,385 @@ File * File_find_by_descriptor(int descriptor) {
 }
 
 
-File * File_find_in_dir(const char *name, const File *directory) {
+/*
+ * Returns the hash of the `length` character name at `name`. Its low bits are the name's slot in a DirIndex.
+ */
+static uint32_t name_hash(const char *name, size_t length) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Orders the `aLength` character name at `a` and the `bLength` character name at `b`, like strcmp.
+ */
+static int compare_names(const char *a, size_t aLength, const char *b, size_t bLength) {
+
+    int order = memcmp(a, b, aLength < bLength ? aLength : bLength);
+
+    if (order != 0) {
+        return order;
+    }
+
+    return (aLength > bLength) - (aLength < bLength);
+}
+
+
+/*
+ * Returns the name of the File with ID `id` in `index's` name heap.
+ */
+static const char * entry_name(const DirIndex *index, FileID id) {
+
+    return index->names + dirEntries[id].nameOffset;
+}
+
+
+/*
+ * Returns the slot of `index` holding the File named by the `length` characters at `name`, whose hash is `hash`,
+ *   or the free slot where it would go.
+ */
+static unsigned int index_find_slot(const DirIndex *index, const char *name, size_t length, uint32_t hash) {
+
+    unsigned int slot = hash & (index->capacity - 1);
+
+    while (index->slots[slot] != FILE_ID_NONE) {
+        const DirEntry *entry = &dirEntries[index->slots[slot]];
+
+        // The names are only compared if their hashes and lengths match, which they rarely do unless the names do.
+        if (entry->hash == hash && entry->length == length && memcmp(index->names + entry->nameOffset, name, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+
+    return slot;
+}
+
+
+/*
+ * Returns the position in `index->sorted` of the first File whose name doesn't sort before the `length` characters at `name`.
+ */
+static unsigned int index_find_position(const DirIndex *index, const char *name, size_t length) {
+
+    unsigned int low = 0, high = index->count;
+
+    while (low < high) {
+        unsigned int middle = low + (high - low) / 2;
+        FileID id = index->sorted[middle];
+
+        if (compare_names(entry_name(index, id), dirEntries[id].length, name, length) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+
+// The index whose Files are being sorted by compare_entries, since qsort can't pass it along.
+static const DirIndex *sortingIndex = NULL;
 
-    if (directory->dirContents == NULL) {
+/*
+ * Orders the IDs of Files in `sortingIndex` by their names, for qsort.
+ */
+static int compare_entries(const void *a, const void *b) {
+
+    FileID first = *(const FileID *)a, second = *(const FileID *)b;
+
+    return compare_names(entry_name(sortingIndex, first), dirEntries[first].length,
+                         entry_name(sortingIndex, second), dirEntries[second].length);
+}
+
+
+/*
+ * Allocates an empty DirIndex with room for `count` Files.
+ *
+ * Returns the DirIndex, or NULL if there isn't enough memory.
+ */
+static DirIndex * index_create(size_t count) {
+
+    unsigned int capacity = DIR_INDEX_MIN_CAPACITY;
+
+    // Keep the index no more than 3/4 full, so that probes stay short.
+    while ((size_t)capacity * 3 < count * 4) {
+        capacity *= 2;
+    }
+
+    // The smallest indexes come from a Pool, since most directories only need one of those.
+    DirIndex *index;
+    if (capacity == DIR_INDEX_MIN_CAPACITY) {
+        index = Pool_alloc(&dirIndexPool);
+    }
+    else {
+        index = malloc(sizeof(DirIndex) + 2 * capacity * sizeof(FileID));
+    }
+    if (!index) {
         return NULL;
     }
 
-    for (FileNode *node = directory->dirContents; node != NULL; node = node->next) {
-        if (strncmp(node->file->name, name, MAX_PATH_COMPONENT_LENGTH) == 0) {
-            return node->file;
+    index->capacity = capacity;
+    index->count = 0;
+    index->sorted = index->slots + capacity;
+    index->names = NULL;
+    index->namesSize = 0;
+    index->namesUsed = 0;
+    index->namesUnused = 0;
+
+    for (unsigned int i = 0; i < capacity; i++) {
+        index->slots[i] = FILE_ID_NONE;
+    }
+
+    return index;
+}
+
+
+/*
+ * Frees `index`, which came from index_create, along with its name heap, or does nothing if it's NULL.
+ */
+static void index_free(DirIndex *index) {
+
+    if (index) {
+        free(index->names);
+    }
+
+    if (index && index->capacity == DIR_INDEX_MIN_CAPACITY) {
+        Pool_free(&dirIndexPool, index);
+    }
+    else {
+        free(index);
+    }
+}
+
+
+/*
+ * Copies the `length` character name at `name`, whose hash is `hash`, into `index's` name heap
+ *   for the File with ID `id`, and fills in the rest of the File's DirEntry that describes its name.
+ *
+ * If the heap is full, it's reallocated with only the names of the Files still in the index,
+ *   so the names of Files that have left the directory don't take up room for good.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ */
+static int index_store_name(DirIndex *index, FileID id, const char *name, size_t length, uint32_t hash) {
+
+    int err_code = 0;
+    DirEntry *entry = &dirEntries[id];
+
+    if (index->namesUsed + length + 1 > index->namesSize) {
+        size_t size = NAME_HEAP_MIN_SIZE;
+
+        // Leave as much room again as the names need, so that the heap isn't reallocated for every new name.
+        while (size < 2 * (index->namesUsed - index->namesUnused + length + 1)) {
+            size *= 2;
         }
+
+        char *names = malloc(size);
+        check_mem(names);
+
+        size_t used = 0;
+        for (unsigned int i = 0; i < index->count; i++) {
+            DirEntry *other = &dirEntries[index->sorted[i]];
+
+            memcpy(names + used, index->names + other->nameOffset, other->length + 1);
+            other->nameOffset = (uint32_t)used;
+            used += other->length + 1;
+        }
+
+        free(index->names);
+        index->names = names;
+        index->namesSize = size;
+        index->namesUsed = used;
+        index->namesUnused = 0;
     }
 
-    return NULL;
+    memcpy(index->names + index->namesUsed, name, length);
+    index->names[index->namesUsed + length] = '\0';
+
+    entry->hash = hash;
+    entry->length = (uint16_t)length;
+    entry->nameOffset = (uint32_t)index->namesUsed;
+    index->namesUsed += length + 1;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Adds the File with ID `id`, whose name is already in the name heap, to the slots of `index`
+ *   and onto the end of its `sorted` array.
+ *
+ * Possible errors:
+ *  - SFS_ERR_INVALID_DATA_FILE (a File with the same name is already in the index, or it's full)
+ */
+static int index_add(DirIndex *index, FileID id) {
+
+    int err_code = 0;
+    const DirEntry *entry = &dirEntries[id];
+
+    // There must always be a free slot, or probing wouldn't end.
+    check(index->count + 1 < index->capacity, SFS_ERR_INVALID_DATA_FILE);
+
+    unsigned int slot = index_find_slot(index, entry_name(index, id), entry->length, entry->hash);
+    check(index->slots[slot] == FILE_ID_NONE, SFS_ERR_INVALID_DATA_FILE);
+
+    index->slots[slot] = id;
+    index->sorted[index->count++] = id;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Replaces `directory's` index with one that has room for `count` Files.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ */
+static int index_grow(File *directory, size_t count) {
+
+    int err_code = 0;
+    DirIndex *old = directory->dirIndex;
+    DirIndex *index = index_create(count);
+
+    check_mem(index);
+
+    // The names stay where they are, so the new index takes over the old one's name heap.
+    if (old) {
+        index->names = old->names;
+        index->namesSize = old->namesSize;
+        index->namesUsed = old->namesUsed;
+        index->namesUnused = old->namesUnused;
+    }
+
+    // The Files are added in sorted order, so they stay that way.
+    for (unsigned int i = 0; old != NULL && i < old->count; i++) {
+        check_err(index_add(index, old->sorted[i]));
+    }
+
+    if (old) {
+        old->names = NULL;
+        index_free(old);
+    }
+    directory->dirIndex = index;
+    return 0;
+
+error:
+    // The name heap still belongs to the old index.
+    if (old) {
+        index->names = NULL;
+    }
+    index_free(index);
+    return err_code;
+}
+
+
+/*
+ * Removes the File in `slot` from `index`.
+ *
+ * The Files after it in the same run of used slots are shifted back into the gap where needed,
+ *   so that every File can still be reached by probing from its name's slot.
+ */
+static void index_remove(DirIndex *index, unsigned int slot) {
+
+    unsigned int mask = index->capacity - 1;
+    unsigned int hole = slot;
+    FileID id = index->slots[slot];
+    unsigned int position = index_find_position(index, entry_name(index, id), dirEntries[id].length);
+
+    memmove(index->sorted + position, index->sorted + position + 1, (index->count - position - 1) * sizeof(FileID));
+    index->slots[hole] = FILE_ID_NONE;
+
+    for (slot = (hole + 1) & mask; index->slots[slot] != FILE_ID_NONE; slot = (slot + 1) & mask) {
+        unsigned int home = dirEntries[index->slots[slot]].hash & mask;
+
+        // The File can fill the hole unless its home slot lies after the hole.
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            index->slots[hole] = index->slots[slot];
+            index->slots[slot] = FILE_ID_NONE;
+            hole = slot;
+        }
+    }
+
+    index->count--;
+    index->namesUnused += dirEntries[id].length + 1;
+}
+
+
+File * File_find_in_dir(const char *name, File *directory) {
+
+    return File_find_component_in_dir(name, strlen(name), directory);
+}
+
+
+File * File_find_component_in_dir(const char *component, size_t length, File *directory) {
+
+    // No File has a longer name.
+    if (length > MAX_PATH_COMPONENT_LENGTH) {
+        return NULL;
+    }
+
+    if (File_load_contents(directory) < 0 || directory->dirIndex == NULL) {
+        return NULL;
+    }
+
+    DirIndex *index = directory->dirIndex;
+    FileID id = index->slots[index_find_slot(index, component, length, name_hash(component, length))];
+
+    return id != FILE_ID_NONE ? File_get(id) : NULL;
+}
+
+
+FileID File_next_in_dir(const char *name, const File *directory) {
+
+    const DirIndex *index = directory->dirIndex;
+    unsigned int position = 0;
+
+    if (index == NULL) {
+        return FILE_ID_NONE;
+    }
+
+    if (name) {
+        size_t length = strlen(name);
+        position = index_find_position(index, name, length);
+
+        // Skip `name` itself if it's still in the directory.
+        if (position < index->count) {
+            FileID id = index->sorted[position];
+
+            if (compare_names(entry_name(index, id), dirEntries[id].length, name, length) == 0) {
+                position++;
+            }
+        }
+    }
+
+    return position < index->count ? index->sorted[position] : FILE_ID_NONE;
 }
 
 
 File * File_get_parent(const File *file) {
 
-    if (file->parentDirectoryID >= 0) {
-        return files + file->parentDirectoryID;
+    if (file->parentDirectoryID == FILE_ID_NONE) {
+        return NULL;
     }
 
-    return NULL;
+    return File_get(file->parentDirectoryID);
 }
 
 
@@ -131,17 +551,27 @@ int File_save(const File *file) {
 
     // Calculate the block that `file` is stored in and the offset where its stored.
     FileID fileID = File_get_id(file);
-    BlockID actualBlock = FileID_to_BlockID(fileID);
+    BlockID actualBlock;
     unsigned char offset = FileID_to_offset(fileID);
 
+    check_err(File_get_block(&inodeTable, FileID_to_table_block(fileID), &actualBlock));
+    check(actualBlock >= 0, SFS_ERR_BLOCK_IO);
+
     // Get the block's data from block I/O.
-    check(get_block(actualBlock, buffer) == 0, SFS_ERR_BLOCK_IO);
+    check_err(Journal_get_block(actualBlock, buffer));
+
+    // Pending data isn't on the device yet, so it mustn't be included in the saved size.
+    File saved = *file;
+    PendingData *pending = PendingData_find(file);
+    if (pending && saved.size > (size_t)pending->firstBlock * BLOCK_SIZE) {
+        saved.size = (size_t)pending->firstBlock * BLOCK_SIZE;
+    }
 
-    // Copy `file` into buffer at offset.
-    memcpy(buffer+offset, file, sizeof(*file));
+    // Encode `file` into buffer at offset.
+    File_encode(&saved, (uint8_t *)buffer + offset);
 
     // Write back the block to block I/O.
-    check(put_block(actualBlock, buffer) == 0, SFS_ERR_BLOCK_IO);
+    check_err(Journal_put_block(actualBlock, buffer));
 
     return 0;
 
@@ -150,35 +580,125 @@ error:
 }
 
 
-int File_add_file_to_dir(File *file, File *directory) {
+int File_load_contents(File *directory) {
 
     int err_code = 0;
+    File block[INODES_PER_BLOCK];
+    char name[MAX_PATH_COMPONENT_LENGTH + 1];
+    DirIndex *index = NULL;
 
-    FileNode *newNode = malloc(sizeof(FileNode));
-    check_mem(newNode);
+    if (!File_is_directory(directory) || directory->contentsLoaded) {
+        return 0;
+    }
 
-    newNode->file = file;
-    newNode->next = NULL;
-    newNode->prev = NULL;
+    // The directory's children are the Files that name it as their parent, wherever they are in the inode table.
+    if (directory->size > 0) {
+        check_err(DirEntries_reserve());
 
-    if (!directory->dirContents) {
-        // Directory is empty, just make this the first entry.
-        directory->dirContents = newNode;
-    }
-    else {
-        // Traverse the list to find the last node.
-        FileNode *lastNode = directory->dirContents;
+        index = index_create(directory->size);
+        check_mem(index);
+
+        for (unsigned int tableBlock = 0; tableBlock < FileID_to_table_block(File_count()); tableBlock++) {
+            check_err(InodeTable_read_block(tableBlock, block));
 
-        while (lastNode->next) {
-            lastNode = lastNode->next;
+            for (unsigned int i = 0; i < INODES_PER_BLOCK; i++) {
+                File *file = &block[i];
+
+                if ((!File_is_data(file) && !File_is_directory(file)) ||
+                    file->parentDirectoryID != directory->id || file->id == directory->id) {
+                    continue;
+                }
+
+                check(index->count < directory->size, SFS_ERR_INVALID_DATA_FILE);
+
+                check_err(File_read_name(file, name));
+                size_t length = strlen(name);
+                check_err(index_store_name(index, file->id, name, length, name_hash(name, length)));
+                check_err(index_add(index, file->id));
+            }
         }
 
-        // Append the new node onto the end of the list.
-        lastNode->next = newNode;
-        newNode->prev = lastNode;
+        check(index->count == directory->size, SFS_ERR_INVALID_DATA_FILE);
+
+        // The inode table isn't in any order, so sort the Files by name and link them together in that order.
+        sortingIndex = index;
+        qsort(index->sorted, index->count, sizeof(FileID), compare_entries);
+        sortingIndex = NULL;
+
+        for (unsigned int i = 0; i < index->count; i++) {
+            DirEntry *entry = &dirEntries[index->sorted[i]];
+
+            entry->prev = i > 0 ? index->sorted[i - 1] : FILE_ID_NONE;
+            entry->next = i + 1 < index->count ? index->sorted[i + 1] : FILE_ID_NONE;
+        }
+    }
+
+    directory->dirIndex = index;
+    directory->contentsLoaded = true;
+    return 0;
+
+error:
+    // Don't leave a partial list behind.
+    index_free(index);
+    return err_code;
+}
+
+
+void File_free_contents(File *directory) {
+
+    index_free(directory->dirIndex);
+    directory->dirIndex = NULL;
+}
+
+
+const char * File_name_in_dir(FileID id, const File *directory) {
+
+    return entry_name(directory->dirIndex, id);
+}
+
+
+int File_add_file_to_dir(File *file, const char *name, size_t length, File *directory) {
+
+    int err_code = 0;
+
+    check_err(File_load_contents(directory));
+    check_err(DirEntries_reserve());
+
+    // Grow the index if it's getting too full (or create it, if the directory was empty).
+    DirIndex *index = directory->dirIndex;
+    if (!index || (size_t)(index->count + 1) * 4 > (size_t)index->capacity * 3) {
+        check_err(index_grow(directory, directory->size + 1));
+        index = directory->dirIndex;
     }
 
+    uint32_t hash = name_hash(name, length);
+    unsigned int slot = index_find_slot(index, name, length, hash);
+    check(index->slots[slot] == FILE_ID_NONE, SFS_ERR_NAME_TAKEN);
+
+    check_err(index_store_name(index, file->id, name, length, hash));
+
+    DirEntry *entry = &dirEntries[file->id];
+    entry->generation++;
+
+    // The File goes between the Files whose names sort either side of it.
+    unsigned int position = index_find_position(index, name, length);
+    entry->prev = position > 0 ? index->sorted[position - 1] : FILE_ID_NONE;
+    entry->next = position < index->count ? index->sorted[position] : FILE_ID_NONE;
+
+    if (entry->prev != FILE_ID_NONE) {
+        dirEntries[entry->prev].next = file->id;
+    }
+    if (entry->next != FILE_ID_NONE) {
+        dirEntries[entry->next].prev = file->id;
+    }
+
+    memmove(index->sorted + position + 1, index->sorted + position, (index->count - position) * sizeof(FileID));
+    index->sorted[position] = file->id;
+    index->slots[slot] = file->id;
+    index->count++;
+
     directory->size++;
+    DentryCache_file_added();
     return 0;
 
 error:
@@ -188,56 +708,51 @@ error:
 
 void File_remove_file_from_dir(const File *file, File *directory) {
 
-    FileNode *node = directory->dirContents;
+    DirIndex *index = directory->dirIndex;
 
     // This shouldn't actually happen.
-    if (!node) {
+    if (!index) {
         debug("Tried to a remove file from an empty directory.");
         return;
     }
 
-    // Find the node that points to `file` in the list.
-    while (node != NULL && node->file != file) {
-        node = node->next;
+    // Find `file` by its name, as long as it has one in this directory's name heap.
+    const DirEntry *found = &dirEntries[file->id];
+    if (found->nameOffset + found->length >= index->namesUsed) {
+        debug("Tried to a remove file from a directory that it is not a part of.");
+        return;
     }
+    unsigned int slot = index_find_slot(index, entry_name(index, file->id), found->length, found->hash);
 
     // Again, shouldn't happen.
-    if (!node) {
+    if (index->slots[slot] != file->id) {
         debug("Tried to a remove file from a directory that it is not a part of.");
         return;
     }
 
-    // If the node is the first node, just update the directory.
-    if (node->prev == NULL) {
-        directory->dirContents = node->next;
+    // Link the Files either side of it together.
+    DirEntry *entry = &dirEntries[file->id];
 
-        // Update the next node if it exists.
-        if (node->next) {
-            node->next->prev = NULL;
-        }
+    if (entry->prev != FILE_ID_NONE) {
+        dirEntries[entry->prev].next = entry->next;
     }
-    else {
-        // Update the previous node to skip this one.
-        node->prev->next = node->next;
-
-        // Update the next node if it exists.
-        if (node->next) {
-            node->next->prev = node->prev;
-        }
+    if (entry->next != FILE_ID_NONE) {
+        dirEntries[entry->next].prev = entry->prev;
     }
 
-    // Free it to prevent a memory leak.
-    free(node);
+    index_remove(index, slot);
+    entry->next = FILE_ID_NONE;
+    entry->prev = FILE_ID_NONE;
+    entry->generation++;
 
-    // Invalidate any last read references.
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        OpenFile *openFile = &openFiles[i];
-        if (openFile->file == directory) {
-            openFile->lastRead = NULL;
-        }
+    // The index is freed once the directory is empty.
+    if (index->count == 0) {
+        index_free(index);
+        directory->dirIndex = NULL;
     }
 
     directory->size--;
+    DentryCache_file_removed();
 }
 
 
@@ -255,6 +770,31 @@ OpenFile * OpenFile_find_empty() {
 }
 
 
+FileID OpenFile_read_next(OpenFile *openFile) {
+
+    FileID id = openFile->lastRead;
+
+    if (id == FILE_ID_NONE) {
+        id = File_next_in_dir(NULL, openFile->file);
+    }
+    else if (dirEntries[id].generation == openFile->lastReadGeneration) {
+        // The File is still where it was, so its links are up to date.
+        id = dirEntries[id].next;
+    }
+    else {
+        id = File_next_in_dir(openFile->lastReadName, openFile->file);
+    }
+
+    openFile->lastRead = id;
+    if (id != FILE_ID_NONE) {
+        openFile->lastReadGeneration = dirEntries[id].generation;
+        strcpy(openFile->lastReadName, File_name_in_dir(id, openFile->file));
+    }
+
+    return id;
+}
+
+
 OpenFile * OpenFile_find_by_descriptor(int descriptor) {
 
     if (descriptor < 0 || descriptor >= MAX_OPEN_FILES) {
@@ -270,76 +810,74 @@ OpenFile * OpenFile_find_by_descriptor(int descriptor) {
 }
 
 
-int path_to_tokens(const char *path, char ***_tokens) {
+int PathIterator_start(PathIterator *iterator, const char *path) {
 
     int err_code = 0;
-    char **tokens = NULL;
-    *_tokens = NULL;
 
-    // `path` must start with a '/'.
+    // "/" has no components, otherwise the first one follows the leading '/'.
+    iterator->component = path;
+    iterator->length = 0;
+    iterator->rest = path[0] == '/' && path[1] == '\0' ? path + 1 : path;
+
     check(path[0] == '/', SFS_ERR_INVALID_PATH);
 
-    // If `path` is "/", make `_tokens` an empty array and return success.
-    if (strcmp(path, "/") == 0) {
-        *_tokens = calloc(1, sizeof(char*));
-        return 0;
-    }
+    return 0;
 
-    // Otherwise, make sure that `path` doesn't end with a '/'.
-    check(path[strlen(path)-1] != '/', SFS_ERR_INVALID_PATH);
+error:
+    // There's nothing left to check.
+    iterator->rest = "";
+    return err_code;
+}
 
-    // Count the number of slashes in `path`.
-    unsigned int slashCount = 0;
-    for (int i = 0; i < strlen(path); i++) {
-        if (path[i] == '/') {
-            slashCount++;
-        }
-    }
 
-    // Allocate enough room for slashCount-many pointers and the NULL terminator.
-    tokens = calloc(slashCount+1, sizeof(char*));
-    check_mem(tokens);
-    unsigned int tokenIndex = 0;
+int PathIterator_next(PathIterator *iterator) {
 
-    unsigned int lastSlash = 0;
+    int err_code = 0;
 
-    for (unsigned int i = 1; i <= strlen(path); i++) {
-        if (path[i] == '/' || path[i] == '\0') {
-            // Calculate the length of the token and check that it is within range.
-            size_t length = i - lastSlash - 1;
-            check(length <= MAX_PATH_COMPONENT_LENGTH, SFS_ERR_INVALID_NAME);
+    if (*iterator->rest == '\0') {
+        return 0;
+    }
 
-            // Allocate enough memory to store it + '\0'.
-            char *token = calloc(length+1, sizeof(char));
-            check_mem(token);
+    // The component runs from just after the '/' up to the next one, or the end of the path.
+    const char *start = iterator->rest + 1;
+    const char *end = start;
 
-            // Copy the token into the buffer.
-            strncpy(token, path+lastSlash+1, length);
+    while (*end != '/' && *end != '\0') {
+        end++;
+    }
 
-            // Add it to the array.
-            tokens[tokenIndex] = token;
-            tokenIndex++;
+    iterator->component = start;
+    iterator->length = (size_t)(end - start);
+    iterator->rest = end;
 
-            // Note the location of this slash.
-            lastSlash = i;
-        }
-    }
+    // Only the last component can't be empty, since that means the path ends with a '/'.
+    check(iterator->length > 0 || *end != '\0', SFS_ERR_INVALID_PATH);
+    check(iterator->length <= MAX_PATH_COMPONENT_LENGTH, SFS_ERR_INVALID_NAME);
 
-    *_tokens = tokens;
-    return 0;
+    return 1;
 
 error:
-    free_tokens(&tokens);
     return err_code;
 }
 
 
-void free_tokens(char ***tokens) {
-    if (*tokens) {
-        for (int i = 0; (*tokens)[i] != NULL; i++) {
-            free((*tokens)[i]);
+int PathIterator_finish(PathIterator *iterator, int err_code) {
+
+    int next;
+
+    if (err_code == SFS_ERR_INVALID_PATH) {
+        return err_code;
+    }
+
+    // A path ending with a '/' is the worst problem a path can have, then a name that's too long.
+    while ((next = PathIterator_next(iterator)) != 0) {
+        if (next == SFS_ERR_INVALID_PATH) {
+            return next;
+        }
+        if (next == SFS_ERR_INVALID_NAME) {
+            err_code = next;
         }
-        free(*tokens);
     }
-    *tokens = NULL;
+
+    return err_code;
 }
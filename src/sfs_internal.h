@@ -31,25 +31,37 @@
 #include <stdint.h>
 
 // Bump this number whenever a change occurs to the File or FileSystemHeader structs.
-#define SFS_DATA_VERSION 1
+#define SFS_DATA_VERSION 13
 
 
 // What kind of file the File object is.
 typedef enum {
     FTYPE_NONE,  // File is not yet in use.
     FTYPE_DATA,  // File is a data file.
-    FTYPE_DIR    // File is a directory.
+    FTYPE_DIR,   // File is a directory.
+    FTYPE_NAME   // File holds part of another File's long name (see FILE_LONG_NAME).
 } FileType;
 
+
+// How changes to metadata are committed to the device (see FileSystemHeader.commitMode).
+// These match the SFS_MODE_* values passed to sfs_format.
+typedef enum {
+    COMMIT_JOURNAL = 0,  // Through the write-ahead journal (see sfs_journal.c).
+    COMMIT_COW = 1,      // By writing changed blocks to new locations (see sfs_shadow.c).
+    COMMIT_LOG = 2       // Copy-on-write, but data blocks are committed too, in one segment per commit.
+} CommitMode;
+
 // A page ID is an ID from 0 to 511, so store it in a 16-bit int.
 // The only valid negative ID is -1, which means “no page”.
 typedef int16_t BlockID;
 
-// A file ID is the i-number of the file, from 0 to 63.
-// The only valid negative ID is -1, which means “no file”.
+// A file ID is the i-number of the file, i.e. its index in the inode table.
+// FILE_ID_NONE means “no file”.
 // This is used as the root directory’s parent (i.e. the
 //   root directory has no parent).
-typedef int8_t FileID;
+typedef uint32_t FileID;
+
+#define FILE_ID_NONE UINT32_MAX
 
 
 // The size of each block, in bytes.
@@ -58,14 +70,107 @@ typedef int8_t FileID;
 // The maximum number of blocks in the file system, including reserved.
 #define MAX_BLOCKS 512
 
-// The maximum number of files that can exist in the file system, include root.
-#define MAX_FILES 64
+// The size of a File as it is stored on the device (see File_encode).
+#define INODE_SIZE 32
+
+// The number of Files stored in a block of the inode table.
+#define INODES_PER_BLOCK (BLOCK_SIZE / INODE_SIZE)
+
+// The number of blocks the inode table grows by when all of its Files are in use.
+#define INODE_CHUNK_BLOCKS 4
+
+// The number of Files in each chunk of the inode table.
+#define FILES_PER_CHUNK (INODE_CHUNK_BLOCKS * INODES_PER_BLOCK)
+
+// The most Files kept in memory once an operation is over, not counting the ones that are in use (see InodeCache_trim).
+#define INODE_CACHE_SIZE 32
+
+// The number of hash buckets the Files in memory are looked up by.
+#define INODE_CACHE_BUCKETS 64
+
+// The number of paths whose lookups are remembered (see DentryCache_lookup). Must be a power of two.
+#define DENTRY_CACHE_SIZE 64
+
+// The longest path whose lookup is remembered. Longer paths are always looked up in full.
+#define DENTRY_PATH_LENGTH 47
+
+// The number of extents stored directly inside a File.
+// Any further extents go in the File's indirect and double indirect blocks.
+#define INODE_EXTENTS 2
+
+// The most data a DATA file can hold inside the File itself, without using any blocks.
+#define INLINE_DATA_SIZE 16
+
+// The size of a fragment, the unit that the last partial block of a DATA file is stored in.
+// Fragments let the tails of several small files share one block.
+#define FRAGMENT_SIZE 32
+
+// The number of fragments in a block.
+#define FRAGMENTS_PER_BLOCK (BLOCK_SIZE / FRAGMENT_SIZE)
+
+// The allocation bitmap is stored in the blocks straight after the header, one byte per block (see Bitmap_encode).
+#define BITMAP_START 1
+#define BITMAP_BLOCKS ((MAX_BLOCKS + BLOCK_SIZE - 1) / BLOCK_SIZE)
 
-// The maximum number of blocks a File can occupy.
-#define MAX_BLOCKS_PER_FILE 4
+// Set in a block's bitmap byte if the block is in use.
+// The low FRAGMENTS_PER_BLOCK bits are the block's `usedFragments`.
+#define BITMAP_USED 0x80
+
+// The write-ahead journal is stored after the allocation bitmap (see sfs_journal.c).
+// In copy-on-write mode, its first blocks hold the superblock slots instead (see sfs_shadow.c).
+#define JOURNAL_START (BITMAP_START + BITMAP_BLOCKS)
+#define JOURNAL_BLOCKS 32
+
+// The first block that isn't reserved for the header, the allocation bitmap or the journal.
+#define FIRST_DATA_BLOCK (JOURNAL_START + JOURNAL_BLOCKS)
+
+// The most metadata blocks a transaction can change, not counting the allocation bitmap.
+// A whole transaction, plus its descriptor and the bitmap, must fit in the journal.
+#define JOURNAL_TRANSACTION_BLOCKS (JOURNAL_OPERATION_BLOCKS + 4)
+
+// The most metadata blocks a single operation can change, which must all be in the same transaction.
+// The largest is creating a File with the longest name: the inode table blocks of the File and each part of its name,
+//   its parent's, and if the inode table grows, the header and up to three of the table's indirect blocks.
+// If fewer than this are left in the running transaction when an operation starts, it's committed first.
+#define JOURNAL_OPERATION_BLOCKS (MAX_PATH_COMPONENT_LENGTH / NAME_PART_LENGTH + 1 + 1 + 1 + 1 + 3)
+
+// In log-structured mode, once fewer blocks than this are free, each commit moves some blocks
+//   from older segments back home, so that the space their copies take can be reused.
+#define LOG_CLEAN_THRESHOLD (MAX_BLOCKS / 8)
+
+// The most blocks the segment cleaner moves back home in one commit.
+#define LOG_CLEAN_BLOCKS 8
+
+// The most snapshots a file system in copy-on-write mode can have at once.
+// Their records are kept in the journal's area, after the superblock slots.
+#define MAX_SNAPSHOTS 4
+
+// The number of decoded indirect and double indirect blocks kept in memory.
+#define MAP_CACHE_SIZE 8
+
+// The number of free blocks set aside after the last block of a file that is being appended to.
+#define RESERVATION_BLOCKS 8
+
+// The most appended blocks that are held in memory, across all files, before some are flushed to the device.
+#define MAX_PENDING_BLOCKS 32
+
+// The number of free blocks kept back for indirect blocks that may be needed when pending blocks are flushed.
+#define PENDING_MAP_BLOCKS 2
+
+// The number of slots a directory's hash index starts with. Must be a power of two.
+#define DIR_INDEX_MIN_CAPACITY 8
 
 // The maximum length of a path component.
-#define MAX_PATH_COMPONENT_LENGTH 6
+#define MAX_PATH_COMPONENT_LENGTH SFS_MAX_NAME_LENGTH
+
+// The longest name stored in the File itself. Longer names are stored in FTYPE_NAME Files.
+#define INODE_NAME_LENGTH 6
+
+// The number of characters of a long name held by each FTYPE_NAME File.
+#define NAME_PART_LENGTH (INODE_SIZE - 6)
+
+// The size a directory's name heap starts at (see DirIndex.names).
+#define NAME_HEAP_MIN_SIZE 64
 
 // The maximum number of OpenFiles that can exist at once.
 #define MAX_OPEN_FILES 4
@@ -95,14 +200,11 @@ typedef struct {
     //   to the format of any of these data structures.
     unsigned int version;
 
-    // Size of the File structure.
-    //
-    // The size of File may change on different platforms,
-    //   causing issues.
+    // Must be equal to INODE_SIZE.
     //
-    // This is written by the library when it creates the
-    //   file system and is used to ensure consistency.
-    size_t fileControlBlockSize;
+    // Files are encoded into a fixed-width format on the device,
+    //   so this doesn't depend on the platform.
+    unsigned int inodeSize;
 
     // These fields hold different constants that are assumptions about the
     //   limits of the file system.
@@ -115,17 +217,39 @@ typedef struct {
     // Must be equal to MAX_BLOCKS.
     unsigned int maxBlocks;
 
-    // Must be equal to MAX_FILES.
-    unsigned int maxFiles;
+    // Must be equal to INODE_EXTENTS.
+    unsigned int inodeExtents;
 
-    // Must be equal to MAX_BLOCKS_PER_FILE.
-    unsigned int maxBlocksPerFile;
+    // Must be equal to INLINE_DATA_SIZE.
+    unsigned int inlineDataSize;
+
+    // Must be equal to FRAGMENT_SIZE.
+    unsigned int fragmentSize;
 
     // Must be equal to MAX_PATH_COMPONENT_LENGTH.
     unsigned int maxPathComponentLength;
 
     // MAX_OPEN_FILES only matters at run-time, so it need not be included.
 
+    // 1 if the file system was unmounted cleanly, otherwise 0.
+    //
+    // This is cleared while the file system is mounted, so if the program stops without unmounting,
+    //   the next mount knows to recover the journal first.
+    // A file system in copy-on-write mode is always clean.
+    unsigned int clean;
+
+    // How changes to metadata are committed, a CommitMode.
+    //
+    // This never changes once the file system is created, so it can be read
+    //   from block 0 itself before blocks are looked up in the shadow map.
+    unsigned int commitMode;
+
+    // The inode table, encoded by File_encode.
+    //
+    // The table is stored like a data file whose contents are all of the
+    //   encoded Files, so that it can grow as more Files are needed.
+    uint8_t inodeTable[INODE_SIZE];
+
     // Must be equal to MAGIC_CODE_2.
     //
     // This is to ensure that the field sizes in this build of the file system
@@ -139,8 +263,49 @@ typedef struct {
 } FileSystemHeader;
 
 
-// Forward declare FileNode because FileNode's definition comes after File's.
-struct sFileNode;
+/*
+ * Extent - A run of contiguous blocks belonging to a data file.
+ *
+ * A File's extents are kept in the order of the data they hold,
+ *   so the first extent holds the start of the file, and so on.
+ */
+typedef struct {
+    // The first block of the run.
+    BlockID start;
+
+    // The number of blocks in the run, or 0 if this extent is unused.
+    uint16_t length;
+
+} Extent;
+
+// The number of extents that fit in an indirect block.
+#define EXTENTS_PER_BLOCK (BLOCK_SIZE / sizeof(Extent))
+
+
+/*
+ * IndirectExtent - A reference to an indirect block from a double indirect block.
+ *
+ * The number of blocks the indirect block covers is stored alongside it,
+ *   so that finding a block only needs the one indirect block that holds it.
+ */
+typedef struct {
+    // The indirect block.
+    BlockID block;
+
+    // Unused, keeps `length` aligned.
+    uint16_t unused;
+
+    // The total length of the indirect block's extents, or 0 if this reference is unused.
+    uint32_t length;
+
+} IndirectExtent;
+
+// The number of indirect blocks a double indirect block can refer to.
+#define INDIRECTS_PER_BLOCK (BLOCK_SIZE / sizeof(IndirectExtent))
+
+
+// Forward declare DirIndex because its definition comes after File's.
+struct sDirIndex;
 
 /*
  * File - A file system object.
@@ -149,13 +314,31 @@ struct sFileNode;
  *   file system.
  * 
  * This is also called the “file control block” or “i-node”.
+ *
+ * This is only the in-memory form. Files are stored on the device in
+ *   the fixed-width format written by File_encode.
  */
 typedef struct {
     // The type of this File.
     FileType type;
 
-    // The name of this File. 6 character + terminator.
-    char name[MAX_PATH_COMPONENT_LENGTH + 1];
+    // The name of this File, if it's no longer than INODE_NAME_LENGTH. 6 characters + terminator.
+    // Longer names are split between FTYPE_NAME Files instead (see FILE_LONG_NAME), and this is empty.
+    char name[INODE_NAME_LENGTH + 1];
+
+    // If the File has the FILE_LONG_NAME flag, the length of its name.
+    uint8_t nameLength;
+
+    // If the File has the FILE_LONG_NAME flag, the FTYPE_NAME File holding the start of its name.
+    FileID nameFirst;
+
+    // A reference to the directory this file is stored in.
+    // This is used at init to rebuild the directory lists.
+    FileID parentDirectoryID;
+
+    // If the file type is DATA, describes how its contents are stored (see FILE_INLINE and FILE_TAIL),
+    //   and for DATA and DIR files, whether the name is stored elsewhere (see FILE_LONG_NAME).
+    uint8_t flags;
 
     // If the file type is DATA, size is the amount of data
     //   in bytes.
@@ -163,44 +346,143 @@ typedef struct {
     //   Files in the dir.
     size_t size;
 
-    // A reference to the directory this file is stored in.
-    // This is used at init to rebuild the directory lists.
-    FileID parentDirectoryID;
-
-    // Only one of these will be in use in a File, never both.
-    // Which one depends on the type of the File.
+    // Only one of these will be in use in a File, never more.
+    // Which one depends on the type and flags of the File.
     union {
         // The blocks the DATA file is stored on.
-        BlockID blocks[MAX_BLOCKS_PER_FILE];
+        struct {
+            // The block holding the extents that didn't fit in `extents`,
+            //   or -1 if there isn't one.
+            BlockID indirectBlock;
+
+            // The block holding references to the indirect blocks for the
+            //   extents that didn't fit in `indirectBlock`, or -1 if there isn't one.
+            BlockID doubleIndirectBlock;
+
+            // The first extents the DATA file is stored on.
+            Extent extents[INODE_EXTENTS];
 
-        // The head of the linked list of Files that make up
-        //   the DIR’s contents.
+            // If the File has the FILE_TAIL flag, the block holding its last partial block's fragments.
+            BlockID tailBlock;
+
+            // If the File has the FILE_TAIL flag, the first of its fragments in `tailBlock`.
+            uint8_t tailFragment;
+        };
+
+        // The contents of the DATA file, if it has the FILE_INLINE flag.
+        char inlineData[INLINE_DATA_SIZE];
+
+        // The part of a long name the NAME file holds.
+        struct {
+            // The NAME file holding the rest of the name, or FILE_ID_NONE if this is the end of it.
+            FileID nameNext;
+
+            // Up to NAME_PART_LENGTH characters of the name, not terminated.
+            char namePart[NAME_PART_LENGTH];
+        };
+
+        // The index of the Files that make up the DIR’s contents, which are linked together in `dirEntries`.
         //
-        // This should be NULL when stored on-disk and is
-        //   generated when the file system is loaded from disk.
-        struct sFileNode *dirContents;
+        // This is not stored on-disk and is generated
+        //   the first time the DIR's contents are needed (see File_load_contents).
+        // It's NULL until then, and whenever the DIR is empty.
+        struct sDirIndex *dirIndex;
     };
 
+    // The File's index in the inode table.
+    //
+    // This is not stored on-disk.
+    FileID id;
+
+    // If the file type is DIR, whether `dirIndex` has been built yet.
+    //
+    // This is not stored on-disk.
+    bool contentsLoaded;
+
 } File;
 
 
+// Flag set on DATA files whose contents are stored in `inlineData` rather than in blocks.
+// Files start out inline and move to blocks once they outgrow INLINE_DATA_SIZE.
+#define FILE_INLINE 0x01
+
+// Flag set on DATA files whose last partial block is stored in fragments of `tailBlock` rather than a whole block.
+// The tail is packed when the File is flushed, and unpacked again if the File is appended to.
+#define FILE_TAIL 0x02
+
+// Flag set on DATA and DIR files whose names are longer than INODE_NAME_LENGTH.
+// The name is split between a chain of FTYPE_NAME Files, starting at `nameFirst` (see File_set_name).
+#define FILE_LONG_NAME 0x04
+
+
 /*
- * FileNode - A linked list node that contains a File object.
+ * DirEntry - Where a File is in its directory's list of contents.
  *
- * Used to link together the files in a directory.
+ * There is one for each File in the inode table, in `dirEntries`,
+ *   so the list is linked through the IDs of the Files in it rather than separately allocated nodes.
  *
  * These are created at run-time and should not be serialized.
  */
-typedef struct sFileNode {
-    File *file;
+typedef struct {
+    // The next File in the directory, or FILE_ID_NONE if this is the last.
+    FileID next;
+
+    // The previous File in the directory, or FILE_ID_NONE if this is the first.
+    FileID prev;
+
+    // Moved on whenever the File is added to or removed from a directory,
+    //   so that a readdir cursor can tell whether the File it stopped at is still where it was.
+    uint32_t generation;
+
+    // The hash of the File's name, so that most names that don't match can be told apart without comparing them.
+    uint32_t hash;
+
+    // The length of the File's name.
+    uint16_t length;
+
+    // Where the File's name is in its directory's name heap (see DirIndex.names),
+    //   so that the directory can be searched without loading every File in it.
+    uint32_t nameOffset;
+
+} DirEntry;
+
+
+/*
+ * DirIndex - The indexes of the names in a directory's list of contents.
+ *
+ * Names are hashed into `slots` with open addressing and linear probing,
+ *   so finding a File in the directory doesn't have to look at every File in it.
+ *
+ * The list is kept sorted by name, and `sorted` holds the same Files in the same order,
+ *   so the place for a new name, or where a listing should carry on from, is found with a binary search.
+ * Its first and last entries are the ends of the list.
+ *
+ * These are created at run-time and should not be serialized.
+ */
+typedef struct sDirIndex {
+    // The number of slots, always a power of two.
+    unsigned int capacity;
+
+    // The number of slots in use, i.e. the number of Files in the directory.
+    unsigned int count;
+
+    // The IDs of the Files sorted by name. Has `capacity` entries, the first `count` of which are used.
+    // This points into the same allocation, just after `slots`.
+    FileID *sorted;
+
+    // The name heap, holding the terminated names of the Files in the directory, wherever their DirEntries say.
+    // The names of Files that have left the directory stay until the heap is next reallocated.
+    char *names;
 
-    // The next FileNode in the list, or NULL if this is the tail.
-    struct sFileNode *next;
+    // The size of `names`, the bytes of it used, and how many of those belong to Files no longer in the directory.
+    size_t namesSize;
+    size_t namesUsed;
+    size_t namesUnused;
 
-    // The previous FileNode in the list, or NULL if the previous is the directory File.
-    struct sFileNode *prev;
+    // The IDs of the Files, each in the first free slot at or after its name's hash, or FILE_ID_NONE for a free slot.
+    FileID slots[];
 
-} FileNode;
+} DirIndex;
 
 
 /*
@@ -215,181 +497,1233 @@ typedef struct {
     // The File object the descriptor is used to access.
     File *file;
 
-    // If file’s type is DIR, this is used to track which node
+    // If file’s type is DIR, this is used to track which File
     //   was read by the last call to sfs_readdir.
     //
     // If sfs_readdir was not called yet, or the file is not a DIR,
-    //   this should be NULL.
-    //
-    // This should also be reset to NULL whenever a file is added
-    //   or removed from the directory.
-    FileNode *lastRead;
+    //   this should be FILE_ID_NONE.
+    FileID lastRead;
+
+    // The generation of `lastRead's` DirEntry when it was read.
+    // If it's still the same, the File is still in the directory, and the listing carries on from its next sibling.
+    uint32_t lastReadGeneration;
+
+    // The name of `lastRead`, so that the listing can carry on from where it was if that File was removed.
+    char lastReadName[MAX_PATH_COMPONENT_LENGTH + 1];
 
 } OpenFile;
 
 
-// ALl the `File` objects, pre-allocated.
-extern File files[MAX_FILES];
+/*
+ * PathIterator - Walks the components of a path one at a time.
+ *
+ * The components are found in the path itself, without copying them,
+ *   so looking up a path doesn't need to allocate anything.
+ *
+ * These are created at run-time and should not be serialized.
+ */
+typedef struct {
+    // The current component. It isn't terminated, since it's part of the path.
+    const char *component;
+
+    // The length of the current component.
+    size_t length;
+
+    // The rest of the path after the current component. Either empty, or starting with the next '/'.
+    const char *rest;
+
+} PathIterator;
+
+
+/*
+ * PendingData - Data appended to a File that hasn't been given blocks on the device yet.
+ *
+ * Blocks are only allocated when the data is flushed, which happens when the File is closed,
+ *   when `sfs_sync` is called, or when too much data is pending.
+ * The allocator can then place all of the pending blocks together.
+ *
+ * The File's size includes the pending data, but the size saved on the device doesn't.
+ *
+ * These are created at run-time and should not be serialized.
+ */
+typedef struct {
+    // The File the data belongs to, or NULL if this is unused.
+    File *file;
+
+    // The index of the first pending block in the File's contents.
+    unsigned int firstBlock;
+
+    // The number of pending blocks.
+    unsigned int blockCount;
+
+    // The contents of the pending blocks, `blockCount * BLOCK_SIZE` bytes.
+    char *data;
+
+} PendingData;
+
+
+// Forward declare PoolSlab because it's private to the Pool functions.
+struct sPoolSlab;
+
+/*
+ * Pool - Allocates objects of one size from larger slabs.
+ *
+ * Freed objects go on a free list and are handed out again before another slab is allocated,
+ *   so metadata that comes and goes doesn't call malloc and free each time.
+ * All of a Pool's slabs are freed together by Pool_release, when the file system is unmounted.
+ *
+ * These are created at run-time and should not be serialized.
+ */
+typedef struct {
+    // The size of each object.
+    size_t objectSize;
+
+    // The number of objects allocated at a time.
+    unsigned int slabObjects;
+
+    // The first free object, which holds a pointer to the next, or NULL if there are none.
+    void *freeList;
+
+    // The slabs allocated so far, or NULL if there are none.
+    struct sPoolSlab *slabs;
+
+} Pool;
+
+// An empty Pool of objects of `size` bytes, allocated `count` at a time.
+#define POOL_INIT(size, count) {(size), (count), NULL, NULL}
+
+
+// The inode table, which holds every File as its contents (see FileSystemHeader.inodeTable).
+//
+// Files are only loaded into memory when they are looked up with File_get.
+extern File inodeTable;
+
+// Where each File in the inode table is in its directory's list of contents, by ID (see DirEntries_reserve).
+extern DirEntry *dirEntries;
 
 // All the `OpenFile` objects, pre-allocated.
 extern OpenFile openFiles[MAX_OPEN_FILES];
 
+// The data waiting to be flushed for each File that has some.
+// Only open Files can have pending data, so there are as many as there are OpenFiles.
+extern PendingData pendingData[MAX_OPEN_FILES];
+
+// The DirIndexes with DIR_INDEX_MIN_CAPACITY slots, which most directories are small enough to use.
+extern Pool dirIndexPool;
+
 // Keeps track of which blocks are unused.
 // `freeBlocks[block]` is true if `block` is unused, otherwise false.
 extern bool freeBlocks[MAX_BLOCKS];
 
+// Keeps track of which fragments of the blocks holding file tails are in use.
+// Bit `i` of `usedFragments[block]` is set if fragment `i` is in use.
+// A block with any fragments in use is not free, and is only released when all of them are.
+extern uint8_t usedFragments[MAX_BLOCKS];
+
 // If `false`, the file system has not been initialized, so no memory clean-up is necessary.
 extern bool initialized;
 
+// How the file system on the device commits changes to its metadata, from its header.
+extern CommitMode commitMode;
+
+// If `true`, a snapshot is mounted, so nothing can be changed.
+extern bool readOnly;
+
 
 /*
- * Finds an empty `File` object.
+ * Returns the number of Files in the inode table, whether they are in use or not.
+ */
+#define File_count() (FileID)(inodeTable.size / INODE_SIZE)
+
+
+/*
+ * Finds the File with ID `id`, loading it from the inode table if it isn't in memory.
  *
- * Returns the `File` or `NULL` if they are all in use.
+ * The rest of the Files in the same block are loaded along with it.
+ * The File stays in memory at least until the end of the current operation (see InodeCache_trim).
+ *
+ * Returns the `File` or `NULL` if the inode table isn't that big or the File couldn't be loaded.
  */
-File * File_find_empty();
+File * File_get(FileID id);
 
 
 /*
- * Finds a `File` by its absolute path, or NULL if it does not exist.
+ * Frees the least recently used Files until at most INODE_CACHE_SIZE are in memory.
  *
- * Possible errors:
- *  - SFS_ERR_OUT_OF_MEMORY
- *  - SFS_ERR_INVALID_PATH
- *  - SFS_ERR_INVALID_NAME
- *  - SFS_ERR_FILE_NOT_FOUND
- *  - SFS_ERR_BAD_FILE_TYPE (if one of of the files in the middle is a data file)
+ * Files that are in use are never freed: those open in an OpenFile, those with pending data,
+ *   and directories whose list of contents has been built and isn't empty.
+ * Every File in memory is already saved, so nothing is written.
+ *
+ * `File` pointers other than those that are in use must not be kept past this call,
+ *   so it is only called at the start of each operation.
  */
-int File_find_by_path(File **file, const char *path);
+void InodeCache_trim(void);
 
 
 /*
- * Finds the `File` that the descriptor has open.
+ * Looks up the `length` character path at `path`, which needn't be terminated, in the cache of recently resolved paths.
  *
- * Return the `File` or `NULL` if that descriptor is invalid.
+ * If the path is cached, `id` is set to the File it leads to, or FILE_ID_NONE if it was found not to exist.
+ *
+ * Returns `true` if the path was cached, otherwise `false`.
  */
-File * File_find_by_descriptor(int descriptor);
+bool DentryCache_lookup(const char *path, size_t length, FileID *id);
 
 
 /*
- * Finds the File in `directory` that is named `name`.
+ * Remembers that the `length` character path at `path` leads to the File with ID `id`,
+ *   or that it doesn't exist if `id` is FILE_ID_NONE.
  *
- * Returns the `File` or `NULL` if it does not exist.
+ * Paths longer than DENTRY_PATH_LENGTH aren't cached.
  */
-File * File_find_in_dir(const char *name, const File *directory);
+void DentryCache_insert(const char *path, size_t length, FileID id);
 
 
 /*
- * Gets the File's parent (i.e. the directory it's contained within).
+ * Forgets the cached paths that were found not to exist, because a File was added to a directory.
+ */
+void DentryCache_file_added(void);
+
+
+/*
+ * Forgets the cached paths that were found to exist, because a File was removed from a directory.
+ */
+void DentryCache_file_removed(void);
+
+
+/*
+ * Forgets all the cached paths, e.g. because the device was reloaded.
+ */
+void DentryCache_clear(void);
+
+
+/*
+ * Finds an empty `File` object, growing the inode table if they are all in use.
  *
- * Returns the `File` or `NULL` if `file` is the root directory.
+ * Returns the `File` or `NULL` if they are all in use and the table can't grow.
  */
-File * File_get_parent(const File *file);
+File * File_find_empty();
 
 
 /*
- * Get the ID of a File based on its address.
+ * Sets up an inode table holding a single chunk of empty Files, for a new file system.
+ *
+ * The header must already be on the device.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NO_MORE_BLOCKS
  */
-#define File_get_id(file) (FileID)(((File*)(file)) - files)
+int InodeTable_create(void);
 
 
 /*
- * Saves the File to the disk.
+ * Loads the inode table described by `encoded`.
+ *
+ * The Files in it are loaded as they are needed, and the table's blocks are not marked as used.
+ *
+ * Possible errors:
+ *  - SFS_ERR_INVALID_DATA_FILE
+ */
+int InodeTable_load(const uint8_t *encoded);
+
+
+/*
+ * Reads the INODES_PER_BLOCK Files in block `index` of the inode table into `files`, without loading them into memory.
+ *
+ * Files that are already in memory are copied from there instead, since they may be newer.
  *
  * Possible errors:
  *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
  */
-int File_save(const File *file);
+int InodeTable_read_block(unsigned int index, File *files);
 
 
 /*
- * Adds `file` to `directory's` list of contents.
+ * Adds up to a chunk of empty Files to the end of the inode table, and saves it.
+ *
+ * At least one block's worth of Files is added if this succeeds.
  *
  * Possible errors:
  *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
  */
-int File_add_file_to_dir(File *file, File *directory);
+int InodeTable_grow(void);
 
 
 /*
- * Removes `file` from `directory's` list of contents.
+ * Frees all of the Files in memory, in use or not, along with directories' lists of contents,
+ *   and forgets the inode table.
+ */
+void InodeTable_free(void);
+
+
+/*
+ * Makes sure `dirEntries` has an entry for every File in the inode table, which may have grown since it was allocated.
  *
- * Only removes the file from the directory in-memory.
- * To remove it from the directory on-disk, the file's parent directory ID should be set to -1 and saved.
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
  */
-void File_remove_file_from_dir(const File *file, File *directory);
+int DirEntries_reserve(void);
 
 
 /*
- * Returns `true` if `file` is a data file, otherwise `false`.
+ * Reads the header from block 0 into `header` and checks that it was written by this build of the file system.
+ *
+ * Sets `commitMode` from the header, and in copy-on-write mode loads the shadow map first,
+ *   so that the header is read from where its last committed copy is.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
  */
-#define File_is_data(file) (bool)((file)->type == FTYPE_DATA)
+int FileSystemHeader_read(FileSystemHeader *header);
 
 
 /*
- * Returns `true` if `file` is a directory, otherwise `false`.
+ * Sets the header's `clean` field on the device.
+ *
+ * The header is written directly, so the journal's running transaction must be empty.
+ * Does nothing in copy-on-write mode, since the file system is always clean.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
  */
-#define File_is_directory(file) (bool)((file)->type == FTYPE_DIR)
+int FileSystemHeader_set_clean(bool clean);
 
 
 /*
- * Find an empty OpenFile object.
+ * Frees everything in memory from the last time the file system was mounted.
  *
- * Returns the OpenFile or `NULL` if they are all in use.
+ * If `save` is `true`, pending data is written out and the journal's running transaction is committed first,
+ *   and the file system is marked as clean.
+ * Otherwise it is left as it is on the device, e.g. because it's about to be erased,
+ *   and whatever wasn't committed is lost as if the program had crashed.
+ *
+ * If saving fails, the file system stays mounted with everything still in memory.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
  */
-OpenFile *OpenFile_find_empty();
+int FileSystem_unmount(bool save);
 
 
 /*
- * Finds an OpenFile by descriptor.
+ * Mounts the file system on the device, or creates a new one that commits changes using `mode`
+ *   if `erase` is `true` or the device is empty (see sfs_initialize).
  *
- * Returns the OpenFile or `NULL` if the descriptor is invalid (out of range or not opened).
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_NEEDS_CHECK
  */
-OpenFile *OpenFile_find_by_descriptor(int descriptor);
+int FileSystem_initialize(bool erase, CommitMode mode);
+
+
+/*
+ * Mounts snapshot `snapshot` of the file system on the device, read-only (see sfs_snapshot_mount_readonly).
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_INVALID_MODE (the file system isn't in a copy-on-write mode)
+ *  - SFS_ERR_SNAPSHOT_NOT_FOUND
+ */
+int FileSystem_mount_snapshot(int snapshot);
 
 
 /*
- * Splits an absolute path into a NULL-terminated array of tokens.
+ * Fully checks the file system on the device, which must not be mounted (it is unmounted if it is).
  *
- * For example, the path "/foo/bar" would be turned into ["foo", "bar"].
+ * Checks that every File is valid, that no block or fragment is used twice,
+ *   that data files' sizes match their blocks and that directories' sizes match their contents.
  *
- * Each token and the list must be freed by the caller.
+ * If `repair` is `true`, the journal is recovered first if it needs to be, the allocation bitmap is rebuilt from the Files, directories' sizes are corrected
+ *   and the file system is marked as clean, so it can be mounted again.
+ * Other problems can't be repaired.
+ *
+ * The file system is left unmounted, unless the one that was mounted couldn't be saved first (see FileSystem_unmount).
  *
  * Possible errors:
  *  - SFS_ERR_OUT_OF_MEMORY
- *  - SFS_ERR_INVALID_PATH
- *  - SFS_ERR_INVALID_NAME
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL (the file system that was mounted couldn't be saved)
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_NEEDS_CHECK (when not repairing, if there is something that needs to be repaired)
+ *  - SFS_ERR_NO_MORE_BLOCKS (the file system that was mounted couldn't be saved)
+ */
+int FileSystem_check(bool repair);
+
+
+/*
+ * Writes an empty journal to the device, for a new file system.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Journal_format(void);
+
+
+/*
+ * Writes the last transaction committed to the journal to the device again,
+ *   in case the file system wasn't unmounted cleanly before it was checkpointed.
+ *
+ * Must be called before the file system is loaded.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NEEDS_CHECK (the journal itself is damaged)
+ */
+int Journal_recover(void);
+
+
+/*
+ * Starts sending metadata changes through the journal, once the file system is mounted.
+ *
+ * If `bitmapSaved` is `false`, the allocation bitmap on the device is out of date (e.g. the file system is new),
+ *   so all of it is written by the first commit.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NEEDS_CHECK
+ */
+int Journal_start(bool bitmapSaved);
+
+
+/*
+ * Commits the running transaction: every metadata block changed since the last commit,
+ *   along with the allocation bitmap, is written to the journal with a single write and then checkpointed.
+ *
+ * Several operations are usually committed together, when the transaction fills up,
+ *   when sfs_sync is called or when the file system is unmounted.
+ * In copy-on-write mode, the transaction is committed by Shadow_commit instead.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Journal_commit(void);
+
+
+/*
+ * Makes sure the running transaction has room for another operation, committing it if it doesn't.
+ * Also commits it if the operation might need blocks that are only freed by committing.
+ *
+ * Called at the start of each operation that changes metadata, so operations are never split between transactions.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Journal_begin(void);
+
+
+/*
+ * Commits the running transaction and stops using the journal, when the file system is unmounted.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Journal_stop(void);
+
+
+/*
+ * Returns `true` if the running transaction has changed `block`, otherwise `false`.
+ */
+bool Journal_has_block(BlockID block);
+
+
+/*
+ * Returns `true` while the running transaction is being committed, otherwise `false`.
+ */
+bool Journal_is_committing(void);
+
+
+/*
+ * Drops the running transaction without committing it, and stops using the journal.
+ */
+void Journal_discard(void);
+
+
+/*
+ * Reads metadata block `block`, including changes that haven't been committed yet.
+ *
+ * Otherwise it's read from wherever its last committed copy is (see Shadow_locate).
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Journal_get_block(BlockID block, char *buffer);
+
+
+/*
+ * Writes metadata block `block` as part of the running transaction.
+ *
+ * If the journal isn't in use, the block is written straight to the device.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_SYSTEM_FULL if the operation changes more than JOURNAL_OPERATION_BLOCKS blocks
+ */
+int Journal_put_block(BlockID block, const char *buffer);
+
+
+/*
+ * Writes the superblock slots for a new file system in copy-on-write mode, in which every block is in its home location.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Shadow_format(void);
+
+
+/*
+ * Loads the shadow map from the newest valid superblock slot, when a file system in copy-on-write mode is mounted.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE (neither slot is valid)
+ */
+int Shadow_load(void);
+
+
+/*
+ * Returns where the last committed copy of metadata block `block` is on the device.
+ *
+ * This is `block` itself unless the file system is in copy-on-write mode and the block has been moved.
+ */
+BlockID Shadow_locate(BlockID block);
+
+
+/*
+ * Commits `count` changed blocks, `blocks`, with contents `data`, along with the allocation bitmap.
+ *
+ * Each block is written to whichever of its home location and a newly allocated block isn't holding its
+ *   last committed copy, then the shadow map's changed pages are written to new blocks,
+ *   and finally the superblock slot not holding the last commit is overwritten to point at them.
+ * The locations that are no longer needed are held until Block_release_held.
+ *
+ * In log-structured mode, every block is written to a new segment instead, and the segment cleaner may run.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int Shadow_commit(const BlockID *blocks, char (*data)[BLOCK_SIZE], unsigned int count);
+
+
+/*
+ * Calls `callback` for each block holding a moved metadata block or a page of the shadow map,
+ *   so that sfs_fsck can mark them as used.
+ *
+ * Stops early and returns the callback's result if it is negative.
+ */
+int Shadow_walk_blocks(int (*callback)(BlockID start, unsigned int length, bool isMap, void *context),
+                       void *context);
+
+
+/*
+ * Returns `true` if a snapshot refers to `block`, so that it can't be allocated or overwritten, otherwise `false`.
+ */
+bool Shadow_is_pinned(BlockID block);
+
+
+/*
+ * Returns how many free blocks are kept for the next commit, which can't be allocated for anything else.
+ *
+ * In copy-on-write and log-structured mode, a commit needs new blocks for the copies it writes,
+ *   and the blocks it frees can't be reused until it's written, so without these a full device could never commit again.
+ */
+unsigned int Shadow_commit_reserve(void);
+
+
+/*
+ * Returns `true` if the file system has any snapshots, otherwise `false`.
+ */
+bool Shadow_has_snapshots(void);
+
+
+/*
+ * Saves the last commit as a new snapshot, and pins the blocks it refers to.
+ *
+ * The running transaction must be empty, so that the last commit is what's in memory.
+ *
+ * Returns the snapshot's number.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_TOO_MANY_SNAPSHOTS
+ */
+int Shadow_create_snapshot(void);
+
+
+/*
+ * Deletes snapshot `snapshot`, unpinning the blocks only it referred to.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_SNAPSHOT_NOT_FOUND
+ */
+int Shadow_delete_snapshot(int snapshot);
+
+
+/*
+ * Replaces the shadow map with snapshot `snapshot`'s, so that blocks are read as they were when it was taken.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_SNAPSHOT_NOT_FOUND
+ */
+int Shadow_load_snapshot(int snapshot);
+
+
+/*
+ * Finds a `File` by its absolute path, or NULL if it does not exist.
+ *
+ * Paths that were looked up recently are found in the DentryCache without walking them,
+ *   and so are ones that were found not to exist.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_INVALID_PATH
+ *  - SFS_ERR_INVALID_NAME
+ *  - SFS_ERR_FILE_NOT_FOUND
+ *  - SFS_ERR_BAD_FILE_TYPE (if one of of the files in the middle is a data file)
+ */
+int File_find_by_path(File **file, const char *path);
+
+
+/*
+ * Finds the directory that the File at the absolute path `path` would be in, whether that File exists or not,
+ *   and builds its list of contents.
+ *
+ * `iterator` is left on the path's last component, i.e. the File's name.
+ * The parent's path is looked up in the DentryCache first, like File_find_by_path.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_PATH (including "/", which has no parent)
+ *  - SFS_ERR_INVALID_NAME
+ *  - SFS_ERR_FILE_NOT_FOUND
+ *  - SFS_ERR_BAD_FILE_TYPE (if the parent or one of the files before it is a data file)
+ */
+int File_find_parent_by_path(File **parent, PathIterator *iterator, const char *path);
+
+
+/*
+ * Finds the `File` that the descriptor has open.
+ *
+ * Return the `File` or `NULL` if that descriptor is invalid.
+ */
+File * File_find_by_descriptor(int descriptor);
+
+
+/*
+ * Finds the File in `directory` that is named `name`, building the directory's list of contents first if needed.
+ *
+ * The name is looked up in the directory's hash index, so this takes the same time however many Files it holds.
+ *
+ * Returns the `File` or `NULL` if it does not exist (or the list couldn't be built).
+ */
+File * File_find_in_dir(const char *name, File *directory);
+
+
+/*
+ * Finds the File in `directory` named by the `length` characters at `component`, which needn't be terminated.
+ *
+ * Otherwise the same as File_find_in_dir.
+ */
+File * File_find_component_in_dir(const char *component, size_t length, File *directory);
+
+
+/*
+ * Finds the first File in `directory's` list of contents whose name sorts after `name`,
+ *   or the first File if `name` is NULL.
+ *
+ * The list is sorted by name, so this continues a listing from `name` even if it's no longer in the directory.
+ * The directory's list of contents must already be built.
+ *
+ * Returns the File's ID, or FILE_ID_NONE if there are no more.
+ */
+FileID File_next_in_dir(const char *name, const File *directory);
+
+
+/*
+ * Gets the File's parent (i.e. the directory it's contained within).
+ *
+ * Returns the `File` or `NULL` if `file` is the root directory (or its parent isn't in the inode table).
+ */
+File * File_get_parent(const File *file);
+
+
+/*
+ * Gives `file` the `length` character name at `name`.
+ *
+ * A name longer than INODE_NAME_LENGTH is split between new FTYPE_NAME Files, which are saved.
+ *   `file` itself isn't saved, and mustn't already have a long name.
+ *
+ * Possible errors:
+ *  - SFS_ERR_INVALID_NAME (`length` is more than MAX_PATH_COMPONENT_LENGTH)
+ *  - SFS_ERR_FILE_SYSTEM_FULL
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_set_name(File *file, const char *name, size_t length);
+
+
+/*
+ * Reads `file's` name into `name`, which must have room for MAX_PATH_COMPONENT_LENGTH + 1 characters.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE (a part of a long name is missing)
+ */
+int File_read_name(const File *file, char *name);
+
+
+/*
+ * Frees the FTYPE_NAME Files holding `file's` name, if it's a long one, and saves them.
+ * `file` itself isn't saved.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_free_name(File *file);
+
+
+/*
+ * Get the ID of a File.
+ */
+#define File_get_id(file) ((file)->id)
+
+
+/*
+ * Writes `file` into `buffer` in the INODE_SIZE byte on-disk format.
+ *
+ * The format has fixed-width, little-endian fields, so it is the same on every platform.
+ */
+void File_encode(const File *file, uint8_t *buffer);
+
+
+/*
+ * Reads a File from `buffer`, which holds a File in the format written by File_encode.
+ *
+ * A directory's `dirIndex` is set to NULL.
+ */
+void File_decode(File *file, const uint8_t *buffer);
+
+
+/*
+ * Saves the File to the disk.
+ *
+ * If the File has pending data, the size saved only covers the part of the File that is on the device.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_save(const File *file);
+
+
+/*
+ * Builds `directory's` list of contents, if it hasn't been built yet.
+ *
+ * The inode table is searched for the Files whose parent is `directory`,
+ *   unless the directory is empty, and the list is sorted by name.
+ * Does nothing if `directory` isn't a directory.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE (the number of Files found doesn't match the directory's size,
+ *                                or two of them have the same name)
+ */
+int File_load_contents(File *directory);
+
+
+/*
+ * Frees `directory's` list of contents and its hash index, if they were built.
+ */
+void File_free_contents(File *directory);
+
+
+/*
+ * Returns the name of the File with ID `id`, which must be in `directory's` list of contents.
+ *
+ * The name belongs to the directory, and may move the next time a File is added to it.
+ */
+const char * File_name_in_dir(FileID id, const File *directory);
+
+
+/*
+ * Adds `file` to `directory's` list of contents under the `length` character name at `name`,
+ *   building the list first if needed.
+ *
+ * The list is kept sorted by name.
+ *
+ * The directory's size is updated, but it isn't saved.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ *  - SFS_ERR_NAME_TAKEN (the directory already has a File with `file's` name)
+ */
+int File_add_file_to_dir(File *file, const char *name, size_t length, File *directory);
+
+
+/*
+ * Removes `file` from `directory's` list of contents.
+ *
+ * The directory's list of contents must already be built.
+ * The directory's hash index is freed once the directory is empty.
+ *
+ * Only removes the file from the directory in-memory, and updates the directory's size without saving it.
+ * To remove it from the directory on-disk, the file should be cleared and saved.
+ */
+void File_remove_file_from_dir(const File *file, File *directory);
+
+
+/*
+ * Returns `true` if `file` is a data file, otherwise `false`.
+ */
+#define File_is_data(file) (bool)((file)->type == FTYPE_DATA)
+
+
+/*
+ * Returns `true` if `file` is a directory, otherwise `false`.
+ */
+#define File_is_directory(file) (bool)((file)->type == FTYPE_DIR)
+
+
+/*
+ * Looks up the block that holds block number `index` of a data file's contents.
+ *
+ * `block` is set to -1 if the file isn't that long.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_get_block(const File *file, unsigned int index, BlockID *block);
+
+
+/*
+ * Adds `block` onto the end of a data file's contents.
+ *
+ * If `block` directly follows the file's last block, the last extent is grown,
+ *   otherwise a new extent is started.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL (all of the file's extents are in use)
+ *  - SFS_ERR_NO_MORE_BLOCKS (an indirect block was needed but none are free)
+ */
+int File_append_block(File *file, BlockID block);
+
+
+/*
+ * Calls `callback` for each run of blocks used by a data file, including its indirect blocks.
+ *
+ * `isMap` is `true` when the run is an indirect or double indirect block.
+ * Stops early and returns the callback's result if it is negative.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_walk_blocks(const File *file,
+                     int (*callback)(BlockID start, unsigned int length, bool isMap, void *context),
+                     void *context);
+
+
+/*
+ * Releases all the blocks used by a data file, including its indirect blocks and tail fragments.
+ *
+ * They are zeroed, and can be reused, once the journal has committed the change (see Block_release_held).
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_free_blocks(File *file);
+
+
+/*
+ * Forgets all the decoded indirect blocks, e.g. because the device was reloaded.
+ */
+void MapCache_clear(void);
+
+
+/*
+ * Marks a free block as used, for data that doesn't belong to a file's contents (e.g. indirect blocks).
+ *
+ * Blocks reserved for files that are being appended to are avoided,
+ *   and the blocks kept for the next commit (see Shadow_commit_reserve) are only used by the commit itself.
+ *
+ * Possible errors:
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int Block_allocate(BlockID *block);
+
+
+/*
+ * Marks a run of up to `want` free blocks as used, for the contents of `file`.
+ *
+ * The run starts at `goal` if possible (normally the block after the file's last block),
+ *   otherwise it is the nearest free run that is long enough, or failing that the longest one.
+ *   If `goal` is -1, the run is placed anywhere.
+ *
+ * The blocks after the run are reserved for `file` so that its next append can continue it.
+ * Like Block_allocate, it leaves the blocks kept for the next commit alone unless it's called by the commit.
+ *
+ * `start` and `length` are set to the run that was allocated, which is at least one block.
+ *
+ * Possible errors:
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int Block_allocate_near(const File *file, BlockID goal, unsigned int want, BlockID *start, unsigned int *length);
+
+
+/*
+ * Returns the number of blocks that are not in use.
+ */
+unsigned int Block_count_free(void);
+
+
+/*
+ * Marks `count` adjacent free fragments as used, for the tail of a data file.
+ *
+ * The fullest block with enough room is picked, and a new block is only started when none has room.
+ *
+ * Possible errors:
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int Fragment_allocate(unsigned int count, BlockID *block, uint8_t *first);
+
+
+/*
+ * Releases `count` fragments of `block` starting at `first`.
+ *
+ * The block itself is freed once none of its fragments are in use.
+ */
+void Fragment_free(BlockID block, uint8_t first, unsigned int count);
+
+
+/*
+ * Marks `block` as free once the journal's running transaction is committed.
+ *
+ * Until then the Files on the device may still refer to it, so it can't be reused.
+ */
+void Block_free(BlockID block);
+
+
+/*
+ * Returns `true` if an operation may need blocks that have been freed since the last commit,
+ *   because there are any and not enough other blocks are free, otherwise `false`.
+ *
+ * They can't be allocated until the running transaction is committed, which only happens between operations.
+ */
+bool Block_should_release_held(void);
+
+
+/*
+ * Returns `true` if `block` has been freed since the last commit, otherwise `false`.
+ */
+bool Block_is_held(BlockID block);
+
+
+/*
+ * Frees the blocks and fragments freed since the last commit, once the commit has been written.
+ *
+ * They are zeroed first, with a single write for each run of whole blocks.
+ */
+void Block_release_held(void);
+
+
+/*
+ * Forgets the blocks and fragments freed since the last commit, e.g. because the transaction was discarded.
+ */
+void Block_forget_held(void);
+
+
+/*
+ * Encodes `freeBlocks` and `usedFragments` into `bitmap`, which is BITMAP_BLOCKS blocks long.
+ */
+void Bitmap_encode(uint8_t *bitmap);
+
+
+/*
+ * Loads `freeBlocks` and `usedFragments` from the allocation bitmap on the device.
+ *
+ * The bitmap is only up-to-date if the file system was unmounted cleanly.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_INVALID_DATA_FILE
+ */
+int Bitmap_load(void);
+
+
+/*
+ * Sets `matches` to whether the allocation bitmap on the device is the same as `freeBlocks` and `usedFragments`.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int Bitmap_compare(bool *matches);
+
+
+/*
+ * Gives up the blocks reserved for `file`, e.g. because it is no longer open.
+ *
+ * If `file` is NULL, every reservation is given up.
+ */
+void Reservation_release(const File *file);
+
+
+/*
+ * Finds the block after a data file's last block, which is where its next block should go.
+ *
+ * `goal` is set to -1 if the file is empty.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ */
+int File_get_goal(const File *file, BlockID *goal);
+
+
+/*
+ * Finds the pending data for `file`, or NULL if it doesn't have any.
+ *
+ * If `file` is NULL, finds an unused PendingData instead.
+ */
+PendingData * PendingData_find(const File *file);
+
+
+/*
+ * Adds a zeroed block to the end of a data file's pending data.
+ *
+ * If too much data is pending, some is flushed first.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NO_MORE_BLOCKS (there wouldn't be enough room on the device to flush it)
+ */
+int File_add_pending_block(File *file);
+
+
+/*
+ * Allocates blocks for all of a File's pending data, writes it to them and saves the File.
+ *
+ * If the File's last block is only partly used, it is packed into fragments instead of a whole block.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int File_flush(File *file);
+
+
+/*
+ * Flushes the pending data of every File.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_FILE_FULL
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int PendingData_flush_all(void);
+
+
+/*
+ * Throws away `file`'s pending data without allocating anything for it.
+ *
+ * If `file` is NULL, all pending data is thrown away.
+ */
+void PendingData_discard(const File *file);
+
+
+/*
+ * Allocates one of `pool's` objects, allocating another slab first if none are free.
+ *
+ * Returns the object, or NULL if there isn't enough memory.
+ */
+void * Pool_alloc(Pool *pool);
+
+
+/*
+ * Puts `object`, which came from `pool`, back on its free list. Does nothing if `object` is NULL.
+ */
+void Pool_free(Pool *pool, void *object);
+
+
+/*
+ * Frees all of `pool's` slabs at once, including any objects that weren't freed.
+ * The Pool is left empty, and can be used again.
+ */
+void Pool_release(Pool *pool);
+
+
+/*
+ * Reads block number `index` of a data file's contents into `buffer`, whether it's inline, pending, in fragments or on the device.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NOT_ENOUGH_DATA (the File isn't that long)
+ */
+int File_read_block(const File *file, unsigned int index, char *buffer);
+
+
+/*
+ * Writes `buffer` over block number `index` of a data file's contents, whether it's inline, pending, in fragments or on the device.
+ *
+ * If the File is inline, the caller must save it afterwards.
+ *
+ * Possible errors:
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NOT_ENOUGH_DATA (the File isn't that long)
+ */
+int File_write_block(File *file, unsigned int index, const char *buffer);
+
+
+/*
+ * Returns `true` if `file` is a data file whose contents are stored inside the File, otherwise `false`.
+ */
+#define File_is_inline(file) (bool)(File_is_data(file) && ((file)->flags & FILE_INLINE))
+
+
+/*
+ * Moves the contents of an inline data file into a pending block, so that it can grow past INLINE_DATA_SIZE.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int File_promote_inline(File *file);
+
+
+/*
+ * Returns `true` if `file` is a data file whose last partial block is stored in fragments, otherwise `false`.
+ */
+#define File_has_tail(file) (bool)(File_is_data(file) && ((file)->flags & FILE_TAIL))
+
+
+/*
+ * Returns the number of fragments needed to hold the last partial block of a data file, or 0 if it has none.
+ */
+#define File_tail_fragments(file) (unsigned int)(((file)->size % BLOCK_SIZE + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE)
+
+
+/*
+ * Moves the tail of a data file out of its fragments and into a pending block, so that it can be appended to.
+ *
+ * Possible errors:
+ *  - SFS_ERR_OUT_OF_MEMORY
+ *  - SFS_ERR_BLOCK_IO
+ *  - SFS_ERR_NO_MORE_BLOCKS
+ */
+int File_unpack_tail(File *file);
+
+
+/*
+ * Find an empty OpenFile object.
+ *
+ * Returns the OpenFile or `NULL` if they are all in use.
+ */
+OpenFile *OpenFile_find_empty();
+
+
+/*
+ * Moves an open directory's readdir cursor on to the next File in it, in sorted order.
+ *
+ * The cursor stays valid however the directory changes: Files added after it are listed,
+ *   and if the File it stopped at was removed, the listing carries on from that File's name.
+ * Otherwise, moving on takes the same time however many Files the directory holds.
+ *
+ * The directory's list of contents must already be built.
+ *
+ * Returns the File's ID, or FILE_ID_NONE if the listing is over, in which case the next call starts it again.
+ */
+FileID OpenFile_read_next(OpenFile *openFile);
+
+
+/*
+ * Finds an OpenFile by descriptor.
+ *
+ * Returns the OpenFile or `NULL` if the descriptor is invalid (out of range or not opened).
+ */
+OpenFile *OpenFile_find_by_descriptor(int descriptor);
+
+
+/*
+ * Starts walking the components of the absolute path `path`.
+ *
+ * The iterator refers to `path` itself, which must not change until the walk is over.
+ *
+ * Possible errors:
+ *  - SFS_ERR_INVALID_PATH (the path doesn't start with a '/')
+ */
+int PathIterator_start(PathIterator *iterator, const char *path);
+
+
+/*
+ * Moves on to the next component of the path.
+ *
+ * For example, the path "/foo/bar" has the components "foo" and "bar", and "/" has none.
+ * The path is only checked as far as the component returned,
+ *   so errors later in the path aren't found until the walk gets to them (see PathIterator_finish).
+ *
+ * Returns 1 if there was another component, or 0 if the path is over.
+ *
+ * Possible errors:
+ *  - SFS_ERR_INVALID_PATH (the path ends with a '/')
+ *  - SFS_ERR_INVALID_NAME (the component is longer than MAX_PATH_COMPONENT_LENGTH)
+ */
+int PathIterator_next(PathIterator *iterator);
+
+
+/*
+ * Returns `true` if the iterator's component is the last one in the path.
  */
-int path_to_tokens(const char *path, char ***tokens);
+#define PathIterator_is_last(iterator) (*(iterator)->rest == '\0')
 
 
 /*
- * Frees the list of tokens returned from `path_to_tokens` and sets it to `NULL`.
+ * Finishes a walk that stopped early with `err_code`, and returns the error to report.
  *
- * `tokens` can be a pointer to valid pointer or a pointer to `NULL`.
+ * The rest of the path is checked, so that a badly formed path is reported as such
+ *   rather than as whatever went wrong with the components before the bad part.
  */
-void free_tokens(char ***tokens);
+int PathIterator_finish(PathIterator *iterator, int err_code);
 
 
 /*
- * Calculates the BlockID of the block that File `file_id` is stored in.
+ * Calculates which block of the inode table's contents File `file_id` is stored in.
  *
- * For example, let's assume that BLOCK_SIZE is 128, sizeof(File) is 40, and file_id is 10:
- *   128 / 40 = 3   3 Files per File block.
- *   10 / 3 = 4     FileID 10 is in the fourth File block.
- *   4 + 1 = 5      The fourth File block is BlockID 5.
+ * For example, let's assume that BLOCK_SIZE is 128, INODE_SIZE is 32, and file_id is 10:
+ *   128 / 32 = 4   4 Files per block.
+ *   10 / 4 = 2     FileID 10 is in block 2 of the inode table, the third one.
  */
-#define FileID_to_BlockID(file_id) (BlockID)((file_id) / (BLOCK_SIZE/sizeof(File)) + 1)
+#define FileID_to_table_block(file_id) (unsigned int)((file_id) / INODES_PER_BLOCK)
 
 
 /*
  * Calculates the offset to the File's data inside the block where File `file_id` is stored.
  *
  * For example, assuming the same parameters as the last example:
- *   128 / 40 = 3   3 Files per File block.
- *   10 % 3 = 1     The index of this File in the block is 1.
- *   1 * 40 = 40    The File is stored 40 bytes into the block.
+ *   128 / 32 = 4   4 Files per File block.
+ *   10 % 4 = 2     The index of this File in the block is 2.
+ *   2 * 32 = 64    The File is stored 64 bytes into the block.
  */
-#define FileID_to_offset(file_id) (unsigned char)((file_id) % (BLOCK_SIZE/sizeof(File)) * sizeof(File))
+#define FileID_to_offset(file_id) (unsigned char)((file_id) % INODES_PER_BLOCK * INODE_SIZE)
 
 #endif
\ No newline at end of file
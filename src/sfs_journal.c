@@ -0,0 +1,449 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * The journal is JOURNAL_BLOCKS blocks starting at JOURNAL_START:
+ *
+ *   - The superblock, which holds JOURNAL_MAGIC and the sequence number of the transaction
+ *       that starts at the beginning of the log.
+ *   - The log, where committed transactions are written one after another, wrapping back to the start
+ *       when a transaction doesn't fit before the end.
+ *
+ * Each transaction is a descriptor block followed by the new contents of the blocks it changes.
+ * The descriptor holds, little-endian:
+ *
+ *   0   JOURNAL_MAGIC          4 bytes
+ *   4   sequence number        4 bytes
+ *   8   checksum               4 bytes, over the rest of the descriptor and every block in the transaction
+ *   12  block count            2 bytes
+ *   14  block numbers          2 bytes each
+ *
+ * The whole transaction is written with a single write, and the checksum shows whether all of it made it.
+ * Once it has, the blocks are written to where they belong (checkpointed).
+ * So after a crash, only the last transaction in the log may need to be written again.
+ *
+ * In copy-on-write mode, transactions are collected the same way but committed by Shadow_commit instead,
+ *   and the journal's blocks hold its superblock slots.
+ */
+#define JOURNAL_MAGIC 0x4C4E524AU
+#define JOURNAL_LOG_START (JOURNAL_START + 1)
+#define JOURNAL_LOG_BLOCKS (JOURNAL_BLOCKS - 1)
+#define JOURNAL_HEADER_SIZE 14
+#define JOURNAL_MAX_BLOCKS (JOURNAL_TRANSACTION_BLOCKS + BITMAP_BLOCKS)
+
+
+// Whether metadata changes go through the journal, i.e. the file system is mounted.
+static bool active = false;
+
+// Whether a commit is being written, so that it isn't started again when the commit itself needs blocks.
+static bool committing = false;
+
+// The blocks changed by the running transaction, and their new contents.
+static BlockID transactionBlocks[JOURNAL_MAX_BLOCKS];
+static char transactionData[JOURNAL_MAX_BLOCKS][BLOCK_SIZE];
+static unsigned int transactionCount = 0;
+
+// Where the next transaction is written in the log, and its sequence number.
+static unsigned int head = 0;
+static uint32_t sequence = 0;
+
+// The allocation bitmap as of the last commit, so only the bitmap blocks that changed are logged.
+static uint8_t committedBitmap[BITMAP_BLOCKS * BLOCK_SIZE];
+
+
+static void put_u16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    put_u16(buffer, (uint16_t)value);
+    put_u16(buffer + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *buffer) {
+    return (uint16_t)(buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buffer) {
+    return get_u16(buffer) | (uint32_t)get_u16(buffer + 2) << 16;
+}
+
+
+/*
+ * Computes the checksum of a transaction: `count` blocks, the first of which is its descriptor.
+ *
+ * The checksum field itself isn't included.
+ */
+static uint32_t checksum(const uint8_t *blocks, unsigned int count) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < (size_t)count * BLOCK_SIZE; i++) {
+        if (i >= 8 && i < 12) {
+            continue;
+        }
+        hash = (hash ^ blocks[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Writes the journal's superblock, so that the log is read from its start with `firstSequence`.
+ */
+static int write_superblock(uint32_t firstSequence) {
+
+    int err_code = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    memset(buffer, 0, sizeof(buffer));
+    put_u32(buffer, JOURNAL_MAGIC);
+    put_u32(buffer + 4, firstSequence);
+    check(put_block(JOURNAL_START, (char *)buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Reads the sequence number of the transaction at the start of the log from the journal's superblock.
+ */
+static int read_superblock(uint32_t *firstSequence) {
+
+    int err_code = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    check(get_block(JOURNAL_START, (char *)buffer) == 0, SFS_ERR_BLOCK_IO);
+    check(get_u32(buffer) == JOURNAL_MAGIC, SFS_ERR_NEEDS_CHECK);
+    *firstSequence = get_u32(buffer + 4);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Finds the index of `block` in the running transaction, or -1 if the transaction hasn't changed it.
+ */
+static int find_block(BlockID block) {
+
+    for (unsigned int i = 0; i < transactionCount; i++) {
+        if (transactionBlocks[i] == block) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+ * Adds `block` to the running transaction with contents `buffer`, or updates it if it's already there.
+ */
+static void log_block(BlockID block, const char *buffer) {
+
+    int index = find_block(block);
+
+    if (index < 0) {
+        index = (int)transactionCount++;
+        transactionBlocks[index] = block;
+    }
+
+    memcpy(transactionData[index], buffer, BLOCK_SIZE);
+}
+
+
+int Journal_format(void) {
+
+    int err_code = 0;
+    char zeroes[JOURNAL_LOG_BLOCKS * BLOCK_SIZE];
+
+    // Anything left in the log from before could be mistaken for a transaction, so it's cleared.
+    memset(zeroes, 0, sizeof(zeroes));
+    check(put_blocks(JOURNAL_LOG_START, JOURNAL_LOG_BLOCKS, zeroes) == 0, SFS_ERR_BLOCK_IO);
+    check_err(write_superblock(1));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Journal_recover(void) {
+
+    int err_code = 0;
+    uint8_t log[JOURNAL_LOG_BLOCKS * BLOCK_SIZE];
+    uint32_t firstSequence;
+    int last = -1;
+
+    check_err(read_superblock(&firstSequence));
+    check(get_blocks(JOURNAL_LOG_START, JOURNAL_LOG_BLOCKS, (char *)log) == 0, SFS_ERR_BLOCK_IO);
+
+    // Follow the transactions from the start of the log until one is missing or incomplete.
+    sequence = firstSequence;
+    for (unsigned int position = 0; position < JOURNAL_LOG_BLOCKS; ) {
+        const uint8_t *descriptor = log + position * BLOCK_SIZE;
+        unsigned int count = get_u16(descriptor + 12);
+
+        if (get_u32(descriptor) != JOURNAL_MAGIC || get_u32(descriptor + 4) != sequence ||
+            count == 0 || count > JOURNAL_MAX_BLOCKS || position + 1 + count > JOURNAL_LOG_BLOCKS ||
+            get_u32(descriptor + 8) != checksum(descriptor, 1 + count)) {
+            break;
+        }
+
+        last = (int)position;
+        position += 1 + count;
+        sequence++;
+    }
+
+    // Every transaction before the last was checkpointed before the next one was committed,
+    //   so only the last one needs to be written again.
+    if (last >= 0) {
+        const uint8_t *descriptor = log + last * BLOCK_SIZE;
+        unsigned int count = get_u16(descriptor + 12);
+
+        for (unsigned int i = 0; i < count; i++) {
+            BlockID block = (BlockID)get_u16(descriptor + JOURNAL_HEADER_SIZE + 2 * i);
+
+            check(block >= 0 && block < MAX_BLOCKS, SFS_ERR_NEEDS_CHECK);
+            check(put_block(block, (char *)descriptor + (1 + i) * BLOCK_SIZE) == 0, SFS_ERR_BLOCK_IO);
+        }
+    }
+
+    // New transactions start at the beginning of the log, with sequence numbers none of the old ones have.
+    check_err(write_superblock(sequence));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Journal_start(bool bitmapSaved) {
+
+    int err_code = 0;
+
+    if (commitMode == COMMIT_JOURNAL) {
+        check_err(read_superblock(&sequence));
+    }
+    head = 0;
+    transactionCount = 0;
+
+    // If the bitmap on the device isn't known, all of it is logged by the first commit.
+    if (bitmapSaved) {
+        Bitmap_encode(committedBitmap);
+    }
+    else {
+        memset(committedBitmap, 0xFF, sizeof(committedBitmap));
+    }
+
+    active = true;
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+bool Journal_has_block(BlockID block) {
+    return active && find_block(block) >= 0;
+}
+
+
+bool Journal_is_committing(void) {
+    return committing;
+}
+
+
+int Journal_commit(void) {
+
+    int err_code = 0;
+    uint8_t bitmap[BITMAP_BLOCKS * BLOCK_SIZE];
+    uint8_t log[(1 + JOURNAL_MAX_BLOCKS) * BLOCK_SIZE];
+
+    // Without a journal the frees were written straight to the device, so there's nothing to wait for.
+    if (!active) {
+        Block_release_held();
+        return 0;
+    }
+
+    // The blocks a commit allocates can't come from committing again.
+    check(!committing, SFS_ERR_NO_MORE_BLOCKS);
+
+    // The allocation bitmap is part of the transaction, so that it always matches the Files after a crash.
+    Bitmap_encode(bitmap);
+
+    if (commitMode != COMMIT_JOURNAL) {
+        if (transactionCount > 0 || memcmp(bitmap, committedBitmap, sizeof(bitmap)) != 0) {
+            committing = true;
+            err_code = Shadow_commit(transactionBlocks, transactionData, transactionCount);
+            committing = false;
+            check_err(err_code);
+
+            transactionCount = 0;
+            Bitmap_encode(committedBitmap);
+        }
+
+        Block_release_held();
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < BITMAP_BLOCKS; i++) {
+        if (memcmp(bitmap + i * BLOCK_SIZE, committedBitmap + i * BLOCK_SIZE, BLOCK_SIZE) != 0) {
+            log_block((BlockID)(BITMAP_START + i), (char *)bitmap + i * BLOCK_SIZE);
+        }
+    }
+
+    if (transactionCount > 0) {
+        unsigned int length = 1 + transactionCount;
+
+        // A transaction never wraps around the end of the log, it starts again at the beginning instead.
+        if (head + length > JOURNAL_LOG_BLOCKS) {
+            check_err(write_superblock(sequence));
+            head = 0;
+        }
+
+        // 1. Write the whole transaction to the log in one go.
+        memset(log, 0, BLOCK_SIZE);
+        put_u32(log, JOURNAL_MAGIC);
+        put_u32(log + 4, sequence);
+        put_u16(log + 12, (uint16_t)transactionCount);
+        for (unsigned int i = 0; i < transactionCount; i++) {
+            put_u16(log + JOURNAL_HEADER_SIZE + 2 * i, (uint16_t)transactionBlocks[i]);
+            memcpy(log + (1 + i) * BLOCK_SIZE, transactionData[i], BLOCK_SIZE);
+        }
+        put_u32(log + 8, checksum(log, length));
+
+        check(put_blocks(JOURNAL_LOG_START + (int)head, (int)length, (char *)log) == 0, SFS_ERR_BLOCK_IO);
+        head += length;
+        sequence++;
+
+        // 2. Now that it's committed, write each block where it belongs.
+        for (unsigned int i = 0; i < transactionCount; i++) {
+            check(put_block(transactionBlocks[i], transactionData[i]) == 0, SFS_ERR_BLOCK_IO);
+        }
+
+        transactionCount = 0;
+        memcpy(committedBitmap, bitmap, sizeof(bitmap));
+    }
+
+    // The blocks freed by the transaction can be reused, now that nothing on the device refers to them.
+    Block_release_held();
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Journal_begin(void) {
+
+    // An operation is never split between two commits, so the running transaction is committed before it starts
+    //   if the operation might not fit, or might need the blocks that are only freed by committing.
+    if ((active && transactionCount + JOURNAL_OPERATION_BLOCKS > JOURNAL_TRANSACTION_BLOCKS) ||
+        Block_should_release_held()) {
+        return Journal_commit();
+    }
+
+    return 0;
+}
+
+
+int Journal_stop(void) {
+
+    int err_code = 0;
+
+    check_err(Journal_commit());
+
+    // The next mount starts the log from the beginning again.
+    if (commitMode == COMMIT_JOURNAL) {
+        check_err(write_superblock(sequence));
+    }
+    active = false;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+void Journal_discard(void) {
+    active = false;
+    transactionCount = 0;
+}
+
+
+int Journal_get_block(BlockID block, char *buffer) {
+
+    int err_code = 0;
+    int index = active ? find_block(block) : -1;
+
+    if (index >= 0) {
+        memcpy(buffer, transactionData[index], BLOCK_SIZE);
+        return 0;
+    }
+
+    check(get_block(Shadow_locate(block), buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Journal_put_block(BlockID block, const char *buffer) {
+
+    int err_code = 0;
+
+    if (!active) {
+        check(put_block(Shadow_locate(block), (char *)buffer) == 0, SFS_ERR_BLOCK_IO);
+        return 0;
+    }
+
+    // Committing here would split the operation, so Journal_begin has left room for all of it.
+    check(find_block(block) >= 0 || transactionCount < JOURNAL_TRANSACTION_BLOCKS, SFS_ERR_FILE_SYSTEM_FULL);
+
+    log_block(block, buffer);
+
+    return 0;
+
+error:
+    return err_code;
+}
@@ -0,0 +1,157 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+
+#include "../sfs.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * Frees the NAME files in the chain starting at `id`, up to `count` of them, and saves them.
+ *
+ * The count stops a damaged chain that loops back on itself from going round forever.
+ */
+static int free_parts(FileID id, unsigned int count) {
+
+    int err_code = 0;
+
+    for (; id != FILE_ID_NONE && id < File_count() && count > 0; count--) {
+        File *part = File_get(id);
+        check(part != NULL, SFS_ERR_OUT_OF_MEMORY);
+
+        if (part->type != FTYPE_NAME) {
+            break;
+        }
+
+        // The File's ID is where it is in the inode table, so it stays the same.
+        id = part->nameNext;
+        FileID partID = part->id;
+        memset(part, 0, sizeof(*part));
+        part->id = partID;
+        check_err(File_save(part));
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_set_name(File *file, const char *name, size_t length) {
+
+    int err_code = 0;
+    FileID next = FILE_ID_NONE;
+
+    check(length <= MAX_PATH_COMPONENT_LENGTH, SFS_ERR_INVALID_NAME);
+
+    if (length <= INODE_NAME_LENGTH) {
+        memcpy(file->name, name, length);
+        file->name[length] = '\0';
+        return 0;
+    }
+
+    // Store the parts from the end of the name back, so that each one can link to the one after it.
+    for (size_t end = length; end > 0;) {
+        size_t start = (end - 1) / NAME_PART_LENGTH * NAME_PART_LENGTH;
+
+        File *part = File_find_empty();
+        check(part != NULL, SFS_ERR_FILE_SYSTEM_FULL);
+
+        // Taking the part straight away stops the next search from finding it again.
+        part->type = FTYPE_NAME;
+        part->flags = 0;
+        part->parentDirectoryID = FILE_ID_NONE;
+        part->size = 0;
+        part->nameNext = next;
+        memset(part->namePart, 0, NAME_PART_LENGTH);
+        memcpy(part->namePart, name + start, end - start);
+        next = part->id;
+
+        check_err(File_save(part));
+        end = start;
+    }
+
+    file->name[0] = '\0';
+    file->flags |= FILE_LONG_NAME;
+    file->nameFirst = next;
+    file->nameLength = (uint8_t)length;
+
+    return 0;
+
+error:
+    // Give back the parts that were taken.
+    free_parts(next, MAX_PATH_COMPONENT_LENGTH / NAME_PART_LENGTH + 1);
+    return err_code;
+}
+
+
+int File_read_name(const File *file, char *name) {
+
+    int err_code = 0;
+    FileID id = file->nameFirst;
+    size_t length = 0;
+
+    if (!(file->flags & FILE_LONG_NAME)) {
+        strcpy(name, file->name);
+        return 0;
+    }
+
+    while (length < file->nameLength) {
+        check(id < File_count(), SFS_ERR_INVALID_DATA_FILE);
+
+        const File *part = File_get(id);
+        check(part != NULL, SFS_ERR_OUT_OF_MEMORY);
+        check(part->type == FTYPE_NAME, SFS_ERR_INVALID_DATA_FILE);
+
+        size_t count = file->nameLength - length < NAME_PART_LENGTH ? file->nameLength - length : NAME_PART_LENGTH;
+        memcpy(name + length, part->namePart, count);
+        length += count;
+        id = part->nameNext;
+    }
+
+    name[length] = '\0';
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_free_name(File *file) {
+
+    int err_code = 0;
+
+    if (!(file->flags & FILE_LONG_NAME)) {
+        return 0;
+    }
+
+    check_err(free_parts(file->nameFirst, (file->nameLength + NAME_PART_LENGTH - 1) / NAME_PART_LENGTH));
+    file->flags &= ~FILE_LONG_NAME;
+    file->nameFirst = 0;
+    file->nameLength = 0;
+
+    return 0;
+
+error:
+    return err_code;
+}
@@ -26,13 +26,14 @@ int sfs_open(char *pathname) {
     int err_code;
     File *file;
 
+    InodeCache_trim();
     check_err(File_find_by_path(&file, pathname));
 
     OpenFile *openFile = OpenFile_find_empty();
     check(openFile != NULL, SFS_ERR_TOO_MANY_OPEN);
 
     openFile->file = file;
-    openFile->lastRead = NULL;
+    openFile->lastRead = FILE_ID_NONE;
 
     return (int)(openFile - openFiles);
 
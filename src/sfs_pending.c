@@ -0,0 +1,451 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+PendingData pendingData[MAX_OPEN_FILES];
+
+
+PendingData * PendingData_find(const File *file) {
+
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (pendingData[i].file == file) {
+            return &pendingData[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Returns the number of pending blocks across all files.
+ */
+static unsigned int pending_total(void) {
+
+    unsigned int total = 0;
+
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (pendingData[i].file) {
+            total += pendingData[i].blockCount;
+        }
+    }
+
+    return total;
+}
+
+
+int File_add_pending_block(File *file) {
+
+    int err_code = 0;
+    PendingData *pending = PendingData_find(file);
+
+    // If too much data is held in memory, flush the file holding the most.
+    if (pending_total() >= MAX_PENDING_BLOCKS) {
+        PendingData *largest = NULL;
+
+        for (int i = 0; i < MAX_OPEN_FILES; i++) {
+            if (pendingData[i].file && (!largest || pendingData[i].blockCount > largest->blockCount)) {
+                largest = &pendingData[i];
+            }
+        }
+
+        check_err(File_flush(largest->file));
+        pending = PendingData_find(file);
+    }
+
+    // Every pending block must be able to get a block when it's flushed,
+    //   plus a couple of indirect blocks in case the File's extents spill over,
+    //   without taking the blocks kept for committing it.
+    check(Block_count_free() > pending_total() + PENDING_MAP_BLOCKS + Shadow_commit_reserve(),
+          SFS_ERR_NO_MORE_BLOCKS);
+
+    if (!pending) {
+        pending = PendingData_find(NULL);
+        check(pending != NULL, SFS_ERR_TOO_MANY_OPEN);
+
+        // An inline File doesn't have any blocks on the device yet,
+        //   and a File's tail fragments aren't one of its blocks.
+        pending->file = file;
+        if (File_is_inline(file)) {
+            pending->firstBlock = 0;
+        }
+        else if (File_has_tail(file)) {
+            pending->firstBlock = (unsigned int)(file->size / BLOCK_SIZE);
+        }
+        else {
+            pending->firstBlock = (unsigned int)((file->size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        pending->blockCount = 0;
+        pending->data = NULL;
+    }
+
+    char *data = realloc(pending->data, (pending->blockCount + 1) * BLOCK_SIZE);
+    check_mem(data);
+
+    memset(data + pending->blockCount * BLOCK_SIZE, 0, BLOCK_SIZE);
+    pending->data = data;
+    pending->blockCount++;
+
+    return 0;
+
+error:
+    // Don't leave an empty entry behind.
+    if (pending && pending->file && pending->blockCount == 0) {
+        pending->file = NULL;
+    }
+    return err_code;
+}
+
+
+/*
+ * Reads `block`, which holds some of a data file's contents, from the device.
+ *
+ * In log-structured mode, or while there are snapshots, data is committed like metadata,
+ *   so the block may be in the running transaction or moved.
+ */
+static int get_data_block(BlockID block, char *buffer) {
+
+    int err_code = 0;
+
+    if (commitMode != COMMIT_JOURNAL) {
+        return Journal_get_block(block, buffer);
+    }
+
+    check(get_block(block, buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Writes `block`, which holds some of a data file's contents, over its old contents.
+ *
+ * In log-structured mode it's added to the running transaction instead,
+ *   so that it's written out in the next segment along with everything else that changed.
+ * The same goes while there are snapshots, since they may share the old contents,
+ *   and for a block that's still in the transaction from when there were.
+ */
+static int put_data_block(BlockID block, const char *buffer) {
+
+    int err_code = 0;
+
+    // The copy a snapshot shares stays pinned, so each block overwritten takes a block for good,
+    //   and must leave the ones kept for committing alone, along with room for a full transaction's worth.
+    if (Shadow_has_snapshots() && !Journal_has_block(block)) {
+        check(Block_count_free() > Shadow_commit_reserve() + JOURNAL_TRANSACTION_BLOCKS, SFS_ERR_NO_MORE_BLOCKS);
+    }
+
+    if (commitMode == COMMIT_LOG || Shadow_has_snapshots() || Journal_has_block(block)) {
+        return Journal_put_block(block, buffer);
+    }
+
+    check(put_block(Shadow_locate(block), (char *)buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Reads the fragments holding a data file's tail into `buffer`, zeroing the rest of it.
+ */
+static int read_tail(const File *file, char *buffer) {
+
+    int err_code = 0;
+    char block[BLOCK_SIZE];
+
+    check_err(get_data_block(file->tailBlock, block));
+    memset(buffer, 0, BLOCK_SIZE);
+    memcpy(buffer, block + file->tailFragment * FRAGMENT_SIZE, File_tail_fragments(file) * FRAGMENT_SIZE);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Writes the start of `buffer` over the fragments holding a data file's tail, leaving the rest of their block alone.
+ */
+static int write_tail(const File *file, const char *buffer) {
+
+    int err_code = 0;
+    char block[BLOCK_SIZE];
+
+    check_err(get_data_block(file->tailBlock, block));
+    memcpy(block + file->tailFragment * FRAGMENT_SIZE, buffer, File_tail_fragments(file) * FRAGMENT_SIZE);
+    check_err(put_data_block(file->tailBlock, block));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Stores a data file's last partial block, `data`, in fragments instead of a whole block.
+ */
+static int pack_tail(File *file, const char *data) {
+
+    int err_code = 0;
+    unsigned int count = File_tail_fragments(file);
+
+    check_err(Fragment_allocate(count, &file->tailBlock, &file->tailFragment));
+
+    err_code = write_tail(file, data);
+    if (err_code < 0) {
+        Fragment_free(file->tailBlock, file->tailFragment, count);
+        sentinel(err_code);
+    }
+
+    file->flags |= FILE_TAIL;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_flush(File *file) {
+
+    int err_code = 0;
+    PendingData *pending = PendingData_find(file);
+
+    if (!pending) {
+        return 0;
+    }
+
+    // The last pending block is the File's last block, so if it's only partly used it can go in fragments,
+    //   unless it would need a whole block's worth of them anyway.
+    unsigned int tailFragments = File_tail_fragments(file);
+    unsigned int tailBlocks = tailFragments > 0 && tailFragments < FRAGMENTS_PER_BLOCK ? 1 : 0;
+
+    while (pending->blockCount > tailBlocks) {
+        BlockID goal = -1, start;
+        unsigned int length;
+
+        // The goal is the block after the last one already on the device.
+        if (pending->firstBlock > 0) {
+            check_err(File_get_block(file, pending->firstBlock - 1, &goal));
+            goal++;
+        }
+
+        // Try to place all the pending blocks in one run, then write the run in one go.
+        check_err(Block_allocate_near(file, goal, pending->blockCount - tailBlocks, &start, &length));
+
+        if (put_blocks(start, (int)length, pending->data) != 0) {
+            for (unsigned int i = 0; i < length; i++) {
+                freeBlocks[start + i] = true;
+            }
+            sentinel(SFS_ERR_BLOCK_IO);
+        }
+
+        for (unsigned int i = 0; i < length; i++) {
+            err_code = File_append_block(file, (BlockID)(start + i));
+            if (err_code < 0) {
+                for (unsigned int j = i; j < length; j++) {
+                    freeBlocks[start + j] = true;
+                }
+                length = i;
+            }
+        }
+
+        // Drop the blocks that made it to the device from the pending data.
+        pending->firstBlock += length;
+        pending->blockCount -= length;
+        memmove(pending->data, pending->data + length * BLOCK_SIZE, pending->blockCount * BLOCK_SIZE);
+        check_err(err_code);
+    }
+
+    if (tailBlocks > 0) {
+        check_err(pack_tail(file, pending->data));
+    }
+
+    PendingData_discard(file);
+    check_err(File_save(file));
+
+    return 0;
+
+error:
+    // Save whatever did make it to the device.
+    File_save(file);
+    return err_code;
+}
+
+
+int PendingData_flush_all(void) {
+
+    int err_code = 0;
+
+    // Each File is flushed in an operation of its own.
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (pendingData[i].file) {
+            check_err(Journal_begin());
+            check_err(File_flush(pendingData[i].file));
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+void PendingData_discard(const File *file) {
+
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        PendingData *pending = &pendingData[i];
+
+        if (pending->file && (file == NULL || pending->file == file)) {
+            free(pending->data);
+            pending->data = NULL;
+            pending->file = NULL;
+            pending->blockCount = 0;
+        }
+    }
+}
+
+
+int File_promote_inline(File *file) {
+
+    int err_code = 0;
+    char contents[INLINE_DATA_SIZE];
+
+    memcpy(contents, file->inlineData, sizeof(contents));
+
+    // The File is still inline at this point, so the new block becomes its first.
+    check_err(File_add_pending_block(file));
+    memcpy(PendingData_find(file)->data, contents, file->size);
+
+    file->flags &= ~FILE_INLINE;
+    memset(file->extents, 0, sizeof(file->extents));
+    file->indirectBlock = -1;
+    file->doubleIndirectBlock = -1;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_unpack_tail(File *file) {
+
+    int err_code = 0;
+    char contents[BLOCK_SIZE];
+
+    check_err(read_tail(file, contents));
+
+    // The File still has its tail at this point, so the new block goes straight after its whole blocks.
+    check_err(File_add_pending_block(file));
+    memcpy(PendingData_find(file)->data, contents, BLOCK_SIZE);
+
+    Fragment_free(file->tailBlock, file->tailFragment, File_tail_fragments(file));
+    file->flags &= ~FILE_TAIL;
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_read_block(const File *file, unsigned int index, char *buffer) {
+
+    int err_code = 0;
+    PendingData *pending = PendingData_find(file);
+    BlockID block;
+
+    // Inline contents are already in memory, so no I/O is needed at all.
+    if (File_is_inline(file)) {
+        check(index == 0, SFS_ERR_NOT_ENOUGH_DATA);
+        memset(buffer, 0, BLOCK_SIZE);
+        memcpy(buffer, file->inlineData, INLINE_DATA_SIZE);
+        return 0;
+    }
+
+    if (File_has_tail(file) && index == file->size / BLOCK_SIZE) {
+        return read_tail(file, buffer);
+    }
+
+    if (pending && index >= pending->firstBlock) {
+        check(index < pending->firstBlock + pending->blockCount, SFS_ERR_NOT_ENOUGH_DATA);
+        memcpy(buffer, pending->data + (index - pending->firstBlock) * BLOCK_SIZE, BLOCK_SIZE);
+        return 0;
+    }
+
+    check_err(File_get_block(file, index, &block));
+    check(block >= 0, SFS_ERR_NOT_ENOUGH_DATA);
+    check_err(get_data_block(block, buffer));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int File_write_block(File *file, unsigned int index, const char *buffer) {
+
+    int err_code = 0;
+    PendingData *pending = PendingData_find(file);
+    BlockID block;
+
+    if (File_is_inline(file)) {
+        check(index == 0, SFS_ERR_NOT_ENOUGH_DATA);
+        memcpy(file->inlineData, buffer, INLINE_DATA_SIZE);
+        return 0;
+    }
+
+    if (File_has_tail(file) && index == file->size / BLOCK_SIZE) {
+        return write_tail(file, buffer);
+    }
+
+    if (pending && index >= pending->firstBlock) {
+        check(index < pending->firstBlock + pending->blockCount, SFS_ERR_NOT_ENOUGH_DATA);
+        memcpy(pending->data + (index - pending->firstBlock) * BLOCK_SIZE, buffer, BLOCK_SIZE);
+        return 0;
+    }
+
+    check_err(File_get_block(file, index, &block));
+    check(block >= 0, SFS_ERR_NOT_ENOUGH_DATA);
+    check_err(put_data_block(block, buffer));
+
+    return 0;
+
+error:
+    return err_code;
+}
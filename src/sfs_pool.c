@@ -0,0 +1,111 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdlib.h>
+
+#include "../sfs.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * The most strictly aligned types an object in a Pool can have.
+ */
+typedef union {
+    void *pointer;
+    long long integer;
+    long double real;
+} PoolAlign;
+
+
+/*
+ * PoolSlab - One allocation holding `slabObjects` of a Pool's objects.
+ */
+typedef struct sPoolSlab {
+    // The Pool's next slab, or NULL if this is the last.
+    struct sPoolSlab *next;
+
+    // The objects, each `objectSize` bytes rounded up to a multiple of sizeof(PoolAlign).
+    PoolAlign objects[];
+
+} PoolSlab;
+
+
+/*
+ * Returns the size of each of `pool's` objects in a slab, which keeps every one of them aligned.
+ * A free object holds the next one on the free list, so it's never smaller than a pointer.
+ */
+static size_t slot_size(const Pool *pool) {
+
+    return (pool->objectSize + sizeof(PoolAlign) - 1) / sizeof(PoolAlign) * sizeof(PoolAlign);
+}
+
+
+void * Pool_alloc(Pool *pool) {
+
+    if (!pool->freeList) {
+        size_t size = slot_size(pool);
+        PoolSlab *slab = malloc(sizeof(PoolSlab) + pool->slabObjects * size);
+
+        if (!slab) {
+            return NULL;
+        }
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        // Put the new objects on the free list, so that the first one is handed out first.
+        for (unsigned int i = pool->slabObjects; i > 0; i--) {
+            void **object = (void **)((char *)slab->objects + (i - 1) * size);
+
+            *object = pool->freeList;
+            pool->freeList = object;
+        }
+    }
+
+    void **object = pool->freeList;
+    pool->freeList = *object;
+
+    return object;
+}
+
+
+void Pool_free(Pool *pool, void *object) {
+
+    if (!object) {
+        return;
+    }
+
+    *(void **)object = pool->freeList;
+    pool->freeList = object;
+}
+
+
+void Pool_release(Pool *pool) {
+
+    while (pool->slabs) {
+        PoolSlab *next = pool->slabs->next;
+
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+
+    pool->freeList = NULL;
+}
@@ -27,6 +27,7 @@ int sfs_read(int fd, int start, int length, char *mem_pointer) {
 
     File *file;
     int err_code;
+    InodeCache_trim();
     file = File_find_by_descriptor(fd);
     check(file!=NULL,SFS_ERR_BAD_FD);
     check (file->type == FTYPE_DATA, SFS_ERR_BAD_FILE_TYPE);
@@ -36,10 +37,8 @@ int sfs_read(int fd, int start, int length, char *mem_pointer) {
 
     check (start + length <= file->size, SFS_ERR_NOT_ENOUGH_DATA);
 
-    int index = file->blocks[start / BLOCK_SIZE];
-
     char boofer[BLOCK_SIZE];
-    check(get_block(index,boofer) == 0, SFS_ERR_BLOCK_IO);
+    check_err(File_read_block(file, (unsigned int)start / BLOCK_SIZE, boofer));
     memcpy(mem_pointer, boofer + (start % BLOCK_SIZE), (size_t )length);
 
     return 0;
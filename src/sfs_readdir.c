@@ -23,6 +23,7 @@
 int sfs_readdir(int fd, char *mem_pointer) {
 
     int err_code;
+    InodeCache_trim();
     mem_pointer[0] = '\0';
 
     OpenFile *openFile = OpenFile_find_by_descriptor(fd);
@@ -30,26 +31,13 @@ int sfs_readdir(int fd, char *mem_pointer) {
 
     File *file = openFile->file;
     check(File_is_directory(file), SFS_ERR_BAD_FILE_TYPE);
+    check_err(File_load_contents(file));
 
-    FileNode *node = file->dirContents;
+    // Names are listed in sorted order, carrying on after the last one read if this was called before.
+    FileID id = OpenFile_read_next(openFile);
 
-    // If this was called before, find the next node.
-    if (openFile->lastRead) {
-        node = file->dirContents;
-
-        // Find `openFile->lastRead` in the list.
-        while (node != openFile->lastRead) {
-            node = node->next;
-        }
-
-        // We want the next node.
-        node = node->next;
-    }
-
-    openFile->lastRead = node;
-
-    if (node) {
-        strcpy(mem_pointer, node->file->name);
+    if (id != FILE_ID_NONE) {
+        strcpy(mem_pointer, File_name_in_dir(id, file));
         return 1;
     }
 
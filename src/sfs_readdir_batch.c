@@ -0,0 +1,72 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+
+#include "../sfs.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+int sfs_readdir_batch(int fd, sfs_dirent *entries, int max) {
+
+    int err_code;
+    int count = 0;
+    InodeCache_trim();
+
+    OpenFile *openFile = OpenFile_find_by_descriptor(fd);
+    check(openFile != NULL, SFS_ERR_BAD_FD);
+
+    File *directory = openFile->file;
+    check(File_is_directory(directory), SFS_ERR_BAD_FILE_TYPE);
+    check_err(File_load_contents(directory));
+
+    while (count < max) {
+        // If an entry can't be read, the cursor is left on the entry before it, so the next call tries it again.
+        OpenFile cursor = *openFile;
+        FileID id = OpenFile_read_next(openFile);
+
+        // Leave the end of the listing for the next call to report, so that it can return zero.
+        if (id == FILE_ID_NONE) {
+            if (count > 0) {
+                *openFile = cursor;
+            }
+            break;
+        }
+
+        // The Files in a directory are usually next to each other in the inode table, so this doesn't read much.
+        File *file = File_get(id);
+        if (file == NULL) {
+            *openFile = cursor;
+            check(count > 0, SFS_ERR_BLOCK_IO);
+            break;
+        }
+
+        sfs_dirent *entry = &entries[count++];
+        strcpy(entry->name, File_name_in_dir(id, openFile->file));
+        entry->inode = id;
+        entry->type = File_is_directory(file) ? 1 : 0;
+        entry->size = (int)file->size;
+    }
+
+    return count;
+
+error:
+    return err_code;
+}
@@ -0,0 +1,704 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sfs.h"
+#include "blockio.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+
+/*
+ * In copy-on-write mode, a metadata block is never overwritten while the last commit on the device refers to it.
+ *
+ * Each metadata block has a home location, its block number, which is what the header and the Files refer to.
+ * When a changed block is committed, it's written to whichever of its home and a newly allocated block
+ *   doesn't hold its last committed copy, so its copies alternate between the two.
+ * The shadow map records where each block's last committed copy is.
+ * It's stored in SHADOW_PAGES pages of SHADOW_PAGE_ENTRIES block numbers each, 2 bytes little-endian,
+ *   and a page in which every block is at home isn't stored at all.
+ *
+ * The pages are found from the superblock, which is kept in one of two slots at the start of the journal's area:
+ *
+ *   0   SHADOW_MAGIC           4 bytes
+ *   4   sequence number        4 bytes, one more for each commit
+ *   8   checksum               4 bytes, over the rest of the slot
+ *   12  page locations         2 bytes each, 0 if the page isn't stored
+ *
+ * A commit writes the changed blocks and pages first, then overwrites the slot holding the older superblock.
+ * That single write publishes the whole commit, so after a crash the newest valid slot is a consistent file system.
+ *
+ * Log-structured mode commits data blocks that are overwritten the same way, instead of writing them in place.
+ * Every block in a commit is written to a new segment: a run of blocks starting where the last one ended,
+ *   so that scattered small overwrites become a few large sequential writes.
+ * The shadow map then plays the part of the inode map, and once free space runs low, a segment cleaner
+ *   moves a few blocks from older segments back home with each commit, so their copies' space can be reused.
+ *
+ * A snapshot is a saved copy of a commit's superblock, kept in one of MAX_SNAPSHOTS records after the slots.
+ * Taking one copies no data: instead, every block the commit refers to is pinned for as long as the snapshot exists.
+ * A pinned block is never allocated or overwritten, even once the live file system no longer uses it,
+ *   so while there are snapshots, overwritten data is committed like in log-structured mode instead of in place.
+ */
+#define SHADOW_MAGIC 0x57444853U
+#define SHADOW_SLOT_START JOURNAL_START
+#define SHADOW_SLOTS 2
+#define SHADOW_HEADER_SIZE 12
+#define SHADOW_PAGE_ENTRIES (BLOCK_SIZE / 2)
+#define SHADOW_PAGES ((MAX_BLOCKS + SHADOW_PAGE_ENTRIES - 1) / SHADOW_PAGE_ENTRIES)
+#define SNAPSHOT_MAGIC 0x50414E53U
+#define SNAPSHOT_START (SHADOW_SLOT_START + SHADOW_SLOTS)
+
+// The most blocks a commit allocates: a new copy of each block in a full transaction and of the bitmap,
+//   and a new location for every page of the shadow map.
+#define COMMIT_RESERVE_BLOCKS (JOURNAL_TRANSACTION_BLOCKS + BITMAP_BLOCKS + SHADOW_PAGES)
+
+
+// Where the last committed copy of each block is.
+static BlockID shadowMap[MAX_BLOCKS];
+
+// Where each page of the shadow map is stored, or 0 if every block in it is at home.
+static BlockID pageLocations[SHADOW_PAGES];
+
+// The sequence number of the last commit.
+static uint32_t sequence = 0;
+
+// Whether each block holds something a snapshot refers to, so it can't be reused or overwritten.
+static bool pinned[MAX_BLOCKS];
+
+// The number of snapshots on the device.
+static unsigned int snapshotCount = 0;
+
+// Where the next segment is written in log-structured mode, just after the last one.
+static BlockID logHead = 0;
+
+// Where the segment cleaner carries on looking for blocks to move back home.
+static BlockID cleanerPosition = 0;
+
+
+static void put_u16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value) {
+    put_u16(buffer, (uint16_t)value);
+    put_u16(buffer + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get_u16(const uint8_t *buffer) {
+    return (uint16_t)(buffer[0] | buffer[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buffer) {
+    return get_u16(buffer) | (uint32_t)get_u16(buffer + 2) << 16;
+}
+
+
+/*
+ * Computes the checksum of a superblock slot.
+ *
+ * The checksum field itself isn't included.
+ */
+static uint32_t checksum(const uint8_t *slot) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        if (i >= 8 && i < 12) {
+            continue;
+        }
+        hash = (hash ^ slot[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Encodes a superblock into `buffer`: `magic`, then `slotSequence` and the locations of the shadow map's pages, `pages`.
+ */
+static void encode_slot(uint8_t *buffer, uint32_t magic, uint32_t slotSequence, const BlockID *pages) {
+
+    memset(buffer, 0, BLOCK_SIZE);
+    put_u32(buffer, magic);
+    put_u32(buffer + 4, slotSequence);
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        put_u16(buffer + SHADOW_HEADER_SIZE + 2 * i, (uint16_t)pages[i]);
+    }
+    put_u32(buffer + 8, checksum(buffer));
+}
+
+
+/*
+ * Returns `true` if `buffer` holds a whole superblock starting with `magic`, otherwise `false`.
+ */
+static bool is_valid_slot(const uint8_t *buffer, uint32_t magic) {
+    return get_u32(buffer) == magic && get_u32(buffer + 8) == checksum(buffer);
+}
+
+
+/*
+ * Writes the superblock for commit `slotSequence`, whose shadow map pages are at `pages`,
+ *   to the slot that doesn't hold the commit before it.
+ */
+static int write_slot(uint32_t slotSequence, const BlockID *pages) {
+
+    int err_code = 0;
+    uint8_t buffer[BLOCK_SIZE];
+
+    encode_slot(buffer, SHADOW_MAGIC, slotSequence, pages);
+    check(put_block(SHADOW_SLOT_START + (int)(slotSequence % SHADOW_SLOTS), (char *)buffer) == 0, SFS_ERR_BLOCK_IO);
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Loads the shadow map that the superblock in `slot` points at into `map`, and where its pages are into `pages`.
+ */
+static int read_map(const uint8_t *slot, BlockID *map, BlockID *pages) {
+
+    int err_code = 0;
+    uint8_t page[BLOCK_SIZE];
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        map[i] = i;
+    }
+
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        BlockID location = (BlockID)get_u16(slot + SHADOW_HEADER_SIZE + 2 * i);
+
+        pages[i] = location;
+        if (location == 0) {
+            continue;
+        }
+
+        check(location >= FIRST_DATA_BLOCK && location < MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
+        check(get_block(location, (char *)page) == 0, SFS_ERR_BLOCK_IO);
+
+        for (unsigned int j = 0; j < SHADOW_PAGE_ENTRIES && i * SHADOW_PAGE_ENTRIES + j < MAX_BLOCKS; j++) {
+            BlockID block = (BlockID)get_u16(page + 2 * j);
+
+            check(block >= 0 && block < MAX_BLOCKS, SFS_ERR_INVALID_DATA_FILE);
+            map[i * SHADOW_PAGE_ENTRIES + j] = block;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Marks every block the snapshot in `record` refers to as pinned:
+ *   the pages of its shadow map, and the copies of each block its allocation bitmap has in use.
+ */
+static int pin_snapshot(const uint8_t *record) {
+
+    int err_code = 0;
+    BlockID map[MAX_BLOCKS], pages[SHADOW_PAGES];
+    uint8_t bitmap[BITMAP_BLOCKS * BLOCK_SIZE];
+
+    check_err(read_map(record, map, pages));
+
+    for (BlockID i = 0; i < BITMAP_BLOCKS; i++) {
+        check(get_block(map[BITMAP_START + i], (char *)bitmap + i * BLOCK_SIZE) == 0, SFS_ERR_BLOCK_IO);
+    }
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (bitmap[i] & BITMAP_USED) {
+            pinned[map[i]] = true;
+        }
+    }
+
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pages[i] != 0) {
+            pinned[pages[i]] = true;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Works out which blocks are pinned from the snapshots on the device.
+ */
+static int load_pins(void) {
+
+    int err_code = 0;
+    uint8_t records[MAX_SNAPSHOTS][BLOCK_SIZE];
+
+    memset(pinned, 0, sizeof(pinned));
+    snapshotCount = 0;
+
+    check(get_blocks(SNAPSHOT_START, MAX_SNAPSHOTS, (char *)records) == 0, SFS_ERR_BLOCK_IO);
+
+    for (unsigned int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (is_valid_slot(records[i], SNAPSHOT_MAGIC)) {
+            check_err(pin_snapshot(records[i]));
+            snapshotCount++;
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_format(void) {
+
+    int err_code = 0;
+    char zeroes[(SHADOW_SLOTS + MAX_SNAPSHOTS) * BLOCK_SIZE];
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        shadowMap[i] = i;
+    }
+    memset(pageLocations, 0, sizeof(pageLocations));
+    memset(pinned, 0, sizeof(pinned));
+    snapshotCount = 0;
+    sequence = 1;
+
+    // The other slot may hold a superblock from an old file system, which could be mistaken for a newer one,
+    //   and the old file system's snapshots are gone.
+    memset(zeroes, 0, sizeof(zeroes));
+    check(put_blocks(SHADOW_SLOT_START, SHADOW_SLOTS + MAX_SNAPSHOTS, zeroes) == 0, SFS_ERR_BLOCK_IO);
+    check_err(write_slot(sequence, pageLocations));
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_load(void) {
+
+    int err_code = 0;
+    uint8_t slots[SHADOW_SLOTS][BLOCK_SIZE];
+    int newest = -1;
+
+    check(get_blocks(SHADOW_SLOT_START, SHADOW_SLOTS, (char *)slots) == 0, SFS_ERR_BLOCK_IO);
+
+    // A slot that was being written when the program stopped doesn't match its checksum, so the other one is used.
+    for (int i = 0; i < SHADOW_SLOTS; i++) {
+        if (is_valid_slot(slots[i], SHADOW_MAGIC) &&
+            (newest < 0 || get_u32(slots[i] + 4) > get_u32(slots[newest] + 4))) {
+            newest = i;
+        }
+    }
+    check(newest >= 0, SFS_ERR_INVALID_DATA_FILE);
+
+    sequence = get_u32(slots[newest] + 4);
+    check_err(read_map(slots[newest], shadowMap, pageLocations));
+    check_err(load_pins());
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+BlockID Shadow_locate(BlockID block) {
+    return commitMode == COMMIT_JOURNAL ? block : shadowMap[block];
+}
+
+
+bool Shadow_is_pinned(BlockID block) {
+    return commitMode != COMMIT_JOURNAL && pinned[block];
+}
+
+
+unsigned int Shadow_commit_reserve(void) {
+    return commitMode == COMMIT_JOURNAL ? 0 : COMMIT_RESERVE_BLOCKS;
+}
+
+
+bool Shadow_has_snapshots(void) {
+    return commitMode != COMMIT_JOURNAL && snapshotCount > 0;
+}
+
+
+/*
+ * Frees the blocks that were allocated for the next copies in `map` and `pages`, because the commit failed.
+ */
+static void undo_locations(const BlockID *map, const BlockID *pages) {
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (map[i] != i && map[i] != shadowMap[i]) {
+            freeBlocks[map[i]] = true;
+        }
+    }
+
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pages[i] != 0 && pages[i] != pageLocations[i]) {
+            freeBlocks[pages[i]] = true;
+        }
+    }
+}
+
+
+/*
+ * Picks where the next copy of `block` goes: home if its last committed copy or a snapshot isn't there,
+ *   otherwise a new block.
+ */
+static int relocate(BlockID *map, BlockID block) {
+
+    int err_code = 0;
+    BlockID location = block;
+
+    if (shadowMap[block] == block || Shadow_is_pinned(block)) {
+        check_err(Block_allocate(&location));
+    }
+
+    map[block] = location;
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Picks where the `count` blocks in `order` go in log-structured mode:
+ *   one after another from the end of the last segment, in as few runs as the free space allows.
+ *
+ * Once the log reaches the end of the device, it carries on from the first data block.
+ */
+static int allocate_segment(BlockID *map, const BlockID *order, unsigned int count) {
+
+    int err_code = 0;
+
+    for (unsigned int done = 0; done < count; ) {
+        if (logHead < FIRST_DATA_BLOCK || logHead >= MAX_BLOCKS) {
+            logHead = FIRST_DATA_BLOCK;
+        }
+
+        BlockID start;
+        unsigned int length;
+
+        check_err(Block_allocate_near(NULL, logHead, count - done, &start, &length));
+
+        for (unsigned int i = 0; i < length; i++) {
+            map[order[done + i]] = (BlockID)(start + i);
+        }
+        done += length;
+        logHead = (BlockID)(start + length);
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+/*
+ * Moves up to LOG_CLEAN_BLOCKS blocks that were written to earlier segments back home when free space runs low,
+ *   so that the space taken by their copies can be reused.
+ * The `count` blocks in `order` are about to get a new segment anyway, so they're left alone.
+ *
+ * The last commit doesn't refer to their home, so it can be written straight away.
+ */
+static int clean_segments(BlockID *map, const BlockID *order, unsigned int count) {
+
+    int err_code = 0;
+    char buffer[BLOCK_SIZE];
+    unsigned int cleaned = 0;
+
+    if (Block_count_free() >= LOG_CLEAN_THRESHOLD) {
+        return 0;
+    }
+
+    for (int i = 0; i < MAX_BLOCKS && cleaned < LOG_CLEAN_BLOCKS; i++) {
+        BlockID block = cleanerPosition;
+        cleanerPosition = (BlockID)((cleanerPosition + 1) % MAX_BLOCKS);
+
+        // Blocks at home, blocks this commit already moves, and blocks whose home a snapshot is using are left alone.
+        bool inCommit = false;
+        for (unsigned int j = 0; j < count && !inCommit; j++) {
+            inCommit = order[j] == block;
+        }
+
+        if (map[block] == block || map[block] != shadowMap[block] || inCommit || Shadow_is_pinned(block)) {
+            continue;
+        }
+
+        check(get_block(map[block], buffer) == 0, SFS_ERR_BLOCK_IO);
+        check(put_block(block, buffer) == 0, SFS_ERR_BLOCK_IO);
+        map[block] = block;
+        cleaned++;
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_commit(const BlockID *blocks, char (*data)[BLOCK_SIZE], unsigned int count) {
+
+    int err_code = 0;
+    BlockID map[MAX_BLOCKS], pages[SHADOW_PAGES];
+    uint8_t pageData[SHADOW_PAGES][BLOCK_SIZE];
+    uint8_t bitmap[BITMAP_BLOCKS * BLOCK_SIZE];
+    BlockID *order = NULL;
+    char *images = NULL;
+    unsigned int total = 0;
+    BlockID head = logHead;
+
+    memcpy(map, shadowMap, sizeof(map));
+    memcpy(pages, pageLocations, sizeof(pages));
+
+    order = malloc((count + BITMAP_BLOCKS) * sizeof(BlockID));
+    check_mem(order);
+    images = malloc((count + BITMAP_BLOCKS) * BLOCK_SIZE);
+    check_mem(images);
+
+    // 1. A block freed since the last commit doesn't need its copy any more, so it goes back home.
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (map[i] != i && Block_is_held(i)) {
+            map[i] = i;
+        }
+    }
+
+    // 2. Collect the changed blocks, followed by the allocation bitmap, which changes with every commit.
+    //    A block that was freed after it was changed isn't written at all.
+    for (unsigned int i = 0; i < count; i++) {
+        if (!Block_is_held(blocks[i])) {
+            memcpy(images + total * BLOCK_SIZE, data[i], BLOCK_SIZE);
+            order[total++] = blocks[i];
+        }
+    }
+
+    unsigned int bitmapIndex = total;
+    for (BlockID i = 0; i < BITMAP_BLOCKS; i++) {
+        order[total++] = (BlockID)(BITMAP_START + i);
+    }
+
+    // 3. Pick where each of them goes.
+    //    In log-structured mode they all go in a new segment, after the cleaner has moved a few older copies back home,
+    //    so that it still runs when the free space is too low for anything else.
+    if (commitMode == COMMIT_LOG) {
+        check_err(clean_segments(map, order, total));
+        check_err(allocate_segment(map, order, total));
+    }
+    else {
+        for (unsigned int i = 0; i < total; i++) {
+            check_err(relocate(map, order[i]));
+        }
+    }
+
+    // 4. Each page of the shadow map that changed goes to a new block, unless every block in it is now at home.
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        bool changed = false, atHome = true;
+
+        memset(pageData[i], 0, BLOCK_SIZE);
+        for (unsigned int j = 0; j < SHADOW_PAGE_ENTRIES && i * SHADOW_PAGE_ENTRIES + j < MAX_BLOCKS; j++) {
+            BlockID block = (BlockID)(i * SHADOW_PAGE_ENTRIES + j);
+
+            put_u16(pageData[i] + 2 * j, (uint16_t)map[block]);
+            changed = changed || map[block] != shadowMap[block];
+            atHome = atHome && map[block] == block;
+        }
+
+        if (changed) {
+            BlockID location = 0;
+
+            if (!atHome) {
+                check_err(Block_allocate(&location));
+            }
+            pages[i] = location;
+        }
+    }
+
+    // 5. The copies this commit replaces can be reused once it's written, so the bitmap saves them as free.
+    Bitmap_encode(bitmap);
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (shadowMap[i] != i && map[i] != shadowMap[i]) {
+            bitmap[shadowMap[i]] = 0;
+        }
+    }
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pageLocations[i] != 0 && pages[i] != pageLocations[i]) {
+            bitmap[pageLocations[i]] = 0;
+        }
+    }
+    memcpy(images + bitmapIndex * BLOCK_SIZE, bitmap, sizeof(bitmap));
+
+    // 6. Write the new copies, with a single write for each run of adjacent ones, and then the pages.
+    //    The last commit doesn't refer to any of them.
+    for (unsigned int i = 0; i < total; ) {
+        unsigned int length = 1;
+
+        while (i + length < total && map[order[i + length]] == map[order[i]] + (BlockID)length) {
+            length++;
+        }
+
+        check(put_blocks(map[order[i]], (int)length, images + i * BLOCK_SIZE) == 0, SFS_ERR_BLOCK_IO);
+        i += length;
+    }
+
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pages[i] != 0 && pages[i] != pageLocations[i]) {
+            check(put_block(pages[i], (char *)pageData[i]) == 0, SFS_ERR_BLOCK_IO);
+        }
+    }
+
+    // 7. Publish the commit.
+    check_err(write_slot(sequence + 1, pages));
+    sequence++;
+
+    // The replaced copies are freed along with the blocks freed by the commit.
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (shadowMap[i] != i && map[i] != shadowMap[i]) {
+            Block_free(shadowMap[i]);
+        }
+    }
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pageLocations[i] != 0 && pages[i] != pageLocations[i]) {
+            Block_free(pageLocations[i]);
+        }
+    }
+
+    memcpy(shadowMap, map, sizeof(map));
+    memcpy(pageLocations, pages, sizeof(pages));
+
+    free(order);
+    free(images);
+    return 0;
+
+error:
+    undo_locations(map, pages);
+    logHead = head;
+    free(order);
+    free(images);
+    return err_code;
+}
+
+
+int Shadow_walk_blocks(int (*callback)(BlockID start, unsigned int length, bool isMap, void *context),
+                       void *context) {
+
+    int err_code = 0;
+
+    if (commitMode == COMMIT_JOURNAL) {
+        return 0;
+    }
+
+    for (BlockID i = 0; i < MAX_BLOCKS; i++) {
+        if (shadowMap[i] != i) {
+            check_err(callback(shadowMap[i], 1, true, context));
+        }
+    }
+
+    for (unsigned int i = 0; i < SHADOW_PAGES; i++) {
+        if (pageLocations[i] != 0) {
+            check_err(callback(pageLocations[i], 1, true, context));
+        }
+    }
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_create_snapshot(void) {
+
+    int err_code = 0;
+    uint8_t records[MAX_SNAPSHOTS][BLOCK_SIZE];
+    int snapshot = -1;
+
+    check(get_blocks(SNAPSHOT_START, MAX_SNAPSHOTS, (char *)records) == 0, SFS_ERR_BLOCK_IO);
+
+    for (int i = 0; i < MAX_SNAPSHOTS && snapshot < 0; i++) {
+        if (!is_valid_slot(records[i], SNAPSHOT_MAGIC)) {
+            snapshot = i;
+        }
+    }
+    check(snapshot >= 0, SFS_ERR_TOO_MANY_SNAPSHOTS);
+
+    // The snapshot is the last commit, so it only needs the commit's superblock.
+    encode_slot(records[snapshot], SNAPSHOT_MAGIC, sequence, pageLocations);
+    check(put_block(SNAPSHOT_START + snapshot, (char *)records[snapshot]) == 0, SFS_ERR_BLOCK_IO);
+    check_err(pin_snapshot(records[snapshot]));
+    snapshotCount++;
+
+    return snapshot;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_delete_snapshot(int snapshot) {
+
+    int err_code = 0;
+    uint8_t record[BLOCK_SIZE];
+
+    check(snapshot >= 0 && snapshot < MAX_SNAPSHOTS, SFS_ERR_SNAPSHOT_NOT_FOUND);
+    check(get_block(SNAPSHOT_START + snapshot, (char *)record) == 0, SFS_ERR_BLOCK_IO);
+    check(is_valid_slot(record, SNAPSHOT_MAGIC), SFS_ERR_SNAPSHOT_NOT_FOUND);
+
+    // The blocks it pinned may be shared with the other snapshots, so they're all worked out again.
+    memset(record, 0, sizeof(record));
+    check(put_block(SNAPSHOT_START + snapshot, (char *)record) == 0, SFS_ERR_BLOCK_IO);
+    check_err(load_pins());
+
+    return 0;
+
+error:
+    return err_code;
+}
+
+
+int Shadow_load_snapshot(int snapshot) {
+
+    int err_code = 0;
+    uint8_t record[BLOCK_SIZE];
+
+    check(snapshot >= 0 && snapshot < MAX_SNAPSHOTS, SFS_ERR_SNAPSHOT_NOT_FOUND);
+    check(get_block(SNAPSHOT_START + snapshot, (char *)record) == 0, SFS_ERR_BLOCK_IO);
+    check(is_valid_slot(record, SNAPSHOT_MAGIC), SFS_ERR_SNAPSHOT_NOT_FOUND);
+
+    sequence = get_u32(record + 4);
+    check_err(read_map(record, shadowMap, pageLocations));
+
+    return 0;
+
+error:
+    return err_code;
+}
@@ -0,0 +1,40 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../sfs.h"
+#include "dbg.h"
+#include "sfs_internal.h"
+
+int sfs_snapshot_create(void) {
+
+    int err_code = 0;
+
+    InodeCache_trim();
+    check(!readOnly, SFS_ERR_READ_ONLY);
+    check(commitMode != COMMIT_JOURNAL, SFS_ERR_INVALID_MODE);
+
+    // Everything written so far is in the snapshot, which is just the last commit.
+    check_err(PendingData_flush_all());
+    check_err(Journal_commit());
+
+    return Shadow_create_snapshot();
+
+error:
+    return err_code;
+}
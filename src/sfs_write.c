@@ -24,8 +24,10 @@
 int sfs_write(int fd, int start, int length, char *mem_pointer) {
     File *file;
     int err_code;
-    BlockID blockID;
     char boofer[BLOCK_SIZE];
+    InodeCache_trim();
+    check(!readOnly, SFS_ERR_READ_ONLY);
+    check_err(Journal_begin());
     file = File_find_by_descriptor(fd);
     check(file!=NULL,SFS_ERR_BAD_FD);
     check(file->type==1,SFS_ERR_BAD_FILE_TYPE);
@@ -34,34 +36,37 @@ int sfs_write(int fd, int start, int length, char *mem_pointer) {
         start = (int)file->size;
 
         check((start/BLOCK_SIZE) == (start+length-1)/BLOCK_SIZE ,SFS_ERR_BLOCK_FAULT );
-        check(start < (BLOCK_SIZE * MAX_BLOCKS_PER_FILE), SFS_ERR_FILE_FULL);
-        blockID = file->blocks[start / BLOCK_SIZE];
 
-        if (blockID==-1) {
-            check(file->blocks[MAX_BLOCKS_PER_FILE-1] == -1, SFS_ERR_FILE_FULL);
-            for (BlockID i = 0; i < MAX_BLOCKS; i++) {
-                if (freeBlocks[i]) {
-                    blockID = i;
-                    break;
-                }
-            }
-            check(blockID != -1,SFS_ERR_NO_MORE_BLOCKS);
+        // The tail can't grow inside its fragments, so it goes back to being a whole block.
+        if (File_has_tail(file)) {
+            check_err(File_unpack_tail(file));
         }
-        check(get_block(blockID, boofer) == 0, SFS_ERR_BLOCK_IO);
 
-        // Mark the block as not free.
-        freeBlocks[blockID] = false;
-        // Add the block ID to the File.
-        for (int i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
-            if (file->blocks[i] == -1) {
-                file->blocks[i] = blockID;
-                break;
+        if (File_is_inline(file)) {
+            // Once the File outgrows the space inside it, its contents move to a block.
+            if (start + length > INLINE_DATA_SIZE) {
+                check_err(File_promote_inline(file));
             }
         }
+        else if (start % BLOCK_SIZE == 0) {
+            // The data starts a new block, which is held in memory until the File is flushed.
+            check_err(File_add_pending_block(file));
+        }
+
+        // The data goes at the end of the File's last block.
+        check_err(File_read_block(file, (unsigned int)start / BLOCK_SIZE, boofer));
+        memcpy(boofer + (start % BLOCK_SIZE), mem_pointer, (size_t )length);
+        check_err(File_write_block(file, (unsigned int)start / BLOCK_SIZE, boofer));
+
         // Update the File's size.
+        // If the data is pending, the File will be saved when it's flushed.
         file->size = file->size + length;
-        File_save(file);
-}
+        if (!PendingData_find(file)) {
+            check_err(File_save(file));
+        }
+
+        return 0;
+    }
     // 3.
     else {
         check(start >= 0, SFS_ERR_INVALID_START_LOC);
@@ -69,14 +74,16 @@ int sfs_write(int fd, int start, int length, char *mem_pointer) {
 
         check ((start / BLOCK_SIZE) == ((start + length) / BLOCK_SIZE), SFS_ERR_BLOCK_FAULT);
 
-
-        blockID = file->blocks[start / BLOCK_SIZE];
-
-        check(get_block(blockID, boofer) == 0, SFS_ERR_BLOCK_IO);
+        check_err(File_read_block(file, (unsigned int)start / BLOCK_SIZE, boofer));
     }
 
     memcpy(boofer + (start % BLOCK_SIZE), mem_pointer, (size_t )length);
-    put_block(blockID, boofer);
+    check_err(File_write_block(file, (unsigned int)start / BLOCK_SIZE, boofer));
+
+    // Inline data is stored in the File itself.
+    if (File_is_inline(file)) {
+        check_err(File_save(file));
+    }
 
     return 0;
 error:
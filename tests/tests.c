@@ -42,31 +42,24 @@ CHEAT_SET_UP(
 
         // Create the test file.
         File *testFile = File_find_empty(),
-            *root = &files[0];
+            *root = File_get(0);
 
         strcpy(testFile->name, "test");
         testFile->type = FTYPE_DATA;
-        for (int i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
-            testFile->blocks[i] = -1;
-        }
+        memset(testFile->extents, 0, sizeof(testFile->extents));
+        testFile->indirectBlock = -1;
+        testFile->doubleIndirectBlock = -1;
 
         // Add the test file to the root directory.
-        // This memory will be freed by the clean-up routine at exit.
-        FileNode *node = malloc(sizeof(FileNode));
-
-        node->file = testFile;
-        node->next = NULL;
-        node->prev = NULL;
-        root->dirContents = node;
-        root->size += 1;
         testFile->parentDirectoryID = 0;
+        File_add_file_to_dir(testFile, testFile->name, strlen(testFile->name), root);
 
         // Open the root directory and test files as FDs 0 and 1 respectively.
         OpenFile *rootOpenFile = &openFiles[0],
         *testOpenFile = &openFiles[1];
 
         rootOpenFile->file = root;
-        rootOpenFile->lastRead = NULL;
+        rootOpenFile->lastRead = FILE_ID_NONE;
         testOpenFile->file = testFile;
 
         // Write some data to the test file.
@@ -75,9 +68,15 @@ CHEAT_SET_UP(
         strcpy(buffer, TEST_FILE_DATA);
 
         put_block(MAX_BLOCKS-1, buffer);
-        testFile->blocks[0] = MAX_BLOCKS-1;
+        freeBlocks[MAX_BLOCKS-1] = false;
+        testFile->extents[0].start = MAX_BLOCKS-1;
+        testFile->extents[0].length = 1;
         testFile->size = sizeof(TEST_FILE_DATA);
 
+        // Save both Files, so the file system is still consistent if a test reloads it.
+        File_save(testFile);
+        File_save(root);
+
         root_fd = 0;
         test_fd = 1;
 )
@@ -90,58 +89,794 @@ CHEAT_TEST(File_find_by_path,
         cheat_assert(File_find_by_path(&file, TEST_FILE_PATH) == 0);
 )
 
+CHEAT_TEST(DentryCache,
+        File *file;
+        FileID id;
+
+        // Both found and missing paths are remembered.
+        cheat_assert(File_find_by_path(&file, TEST_FILE_PATH) == 0);
+        cheat_assert(DentryCache_lookup(TEST_FILE_PATH, strlen(TEST_FILE_PATH), &id) && id == file->id);
+        cheat_assert(File_find_by_path(&file, "/d/a") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(DentryCache_lookup("/d/a", 4, &id) && id == FILE_ID_NONE);
+
+        // Creating a File forgets the missing paths, but not the found ones.
+        cheat_assert(sfs_create("/d", 1) == 0);
+        cheat_assert(sfs_create("/d/a", 0) == 0);
+        cheat_assert(!DentryCache_lookup("/x", 2, &id));
+        cheat_assert(DentryCache_lookup(TEST_FILE_PATH, strlen(TEST_FILE_PATH), &id));
+        cheat_assert(File_find_by_path(&file, "/d/a") == 0);
+        cheat_assert(DentryCache_lookup("/d/a", 4, &id) && id == file->id);
+
+        // Deleting a File forgets the found paths.
+        cheat_assert(File_find_by_path(&file, "/x") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(sfs_delete("/d/a") == 0);
+        cheat_assert(!DentryCache_lookup("/d/a", 4, &id));
+        cheat_assert(DentryCache_lookup("/x", 2, &id) && id == FILE_ID_NONE);
+        cheat_assert(File_find_by_path(&file, "/d/a") == SFS_ERR_FILE_NOT_FOUND);
+
+        // Nothing is remembered across mounts.
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(!DentryCache_lookup("/d/a", 4, &id));
+)
+
+CHEAT_TEST(Pool,
+        Pool pool = POOL_INIT(sizeof(File), 2);
+        void *first = Pool_alloc(&pool);
+        void *second = Pool_alloc(&pool);
+
+        cheat_assert(first != NULL && second != NULL && first != second);
+
+        // Freed objects are handed out again before anything else.
+        Pool_free(&pool, first);
+        cheat_assert(Pool_alloc(&pool) == first);
+
+        // Another slab is allocated when the first is used up.
+        void *third = Pool_alloc(&pool);
+        cheat_assert(third != NULL && third != first && third != second);
+        cheat_assert(pool.slabs != NULL && pool.freeList != NULL);
+
+        Pool_release(&pool);
+        cheat_assert(pool.slabs == NULL && pool.freeList == NULL);
+)
+
 CHEAT_SKIP(File_find_by_descriptor,
         ; // TODO: Expand once `sfs_open` is implemented.
 )
 
 CHEAT_TEST(File_find_in_dir,
-        cheat_assert(File_find_in_dir(TEST_FILE_NAME, &files[0]) != NULL);
-        cheat_assert(File_find_in_dir(TEST_FILE_NAME "2", &files[0]) == NULL);
+        cheat_assert(File_find_in_dir(TEST_FILE_NAME, File_get(0)) != NULL);
+        cheat_assert(File_find_in_dir(TEST_FILE_NAME "2", File_get(0)) == NULL);
+)
+
+CHEAT_TEST(directory_index,
+        char path[16];
+        File *root = File_get(0);
+
+        // Enough Files to grow the index a few times.
+        for (int i = 0; i < 40; i++) {
+            sprintf(path, "/f%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+        cheat_assert(root->dirIndex->count == root->size);
+        cheat_assert(root->dirIndex->capacity * 3 >= root->size * 4);
+
+        // Removing Files mustn't hide the ones that probed past them.
+        for (int i = 0; i < 40; i += 3) {
+            sprintf(path, "/f%d", i);
+            cheat_assert(sfs_delete(path) == 0);
+        }
+        for (int i = 0; i < 40; i++) {
+            sprintf(path, "f%d", i);
+            cheat_assert((File_find_in_dir(path, root) == NULL) == (i % 3 == 0));
+        }
+        cheat_assert(root->dirIndex->count == root->size);
+
+        // The Files are linked together through their DirEntries, in order, with no allocations of their own.
+        size_t linked = 0;
+        FileID previous = FILE_ID_NONE;
+        for (FileID id = root->dirIndex->sorted[0]; id != FILE_ID_NONE; id = dirEntries[id].next) {
+            cheat_assert(dirEntries[id].prev == previous);
+            cheat_assert(previous == FILE_ID_NONE || strcmp(File_name_in_dir(previous, root), File_name_in_dir(id, root)) < 0);
+            previous = id;
+            linked++;
+        }
+        cheat_assert(linked == root->size);
+        cheat_assert(previous == root->dirIndex->sorted[root->dirIndex->count - 1]);
+
+        // The name-taken check uses the index too.
+        File *file = File_get(File_find_in_dir("f1", root)->id);
+        cheat_assert(File_add_file_to_dir(file, "f1", 2, root) == SFS_ERR_NAME_TAKEN);
+
+        // The index is rebuilt along with the list after remounting.
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        root = File_get(0);
+        cheat_assert(File_find_in_dir("f38", root) != NULL);
+        cheat_assert(File_find_in_dir("f39", root) == NULL);
+        cheat_assert(root->dirIndex->count == root->size);
+)
+
+CHEAT_TEST(directory_order,
+        const char *names[] = {"m", "b", "zz", "a", "q", "ab"};
+        const char *sorted[] = {"a", "ab", "b", "m", "q", "test", "zz"};
+        char path[16], name[MAX_PATH_COMPONENT_LENGTH + 1];
+        File *root = File_get(0);
+        int fd;
+
+        for (int i = 0; i < 6; i++) {
+            sprintf(path, "/%s", names[i]);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+
+        // Listings come out sorted by name, both as created and after the list is loaded from the inode table.
+        for (int pass = 0; pass < 2; pass++) {
+            cheat_assert((fd = sfs_open("/")) >= 0);
+            for (int i = 0; i < 7; i++) {
+                cheat_assert(sfs_readdir(fd, name) == 1);
+                cheat_assert(strcmp(name, sorted[i]) == 0);
+            }
+            cheat_assert(sfs_readdir(fd, name) == 0);
+            cheat_assert(sfs_close(fd) == 0);
+
+            if (pass == 0) {
+                cheat_assert(sfs_close(test_fd) == 0);
+                cheat_assert(sfs_initialize(0) == 0);
+                root = File_get(0);
+            }
+        }
+
+        // A listing can carry on from a name that's no longer in the directory.
+        cheat_assert(File_load_contents(root) == 0);
+        cheat_assert(strcmp(File_name_in_dir(File_next_in_dir(NULL, root), root), "a") == 0);
+        cheat_assert(strcmp(File_name_in_dir(File_next_in_dir("ab", root), root), "b") == 0);
+        cheat_assert(sfs_delete("/b") == 0);
+        cheat_assert(strcmp(File_name_in_dir(File_next_in_dir("ab", root), root), "m") == 0);
+        cheat_assert(strcmp(File_name_in_dir(File_next_in_dir("b", root), root), "m") == 0);
+        cheat_assert(File_next_in_dir("zz", root) == FILE_ID_NONE);
+)
+
+CHEAT_TEST(long_names,
+        char longest[MAX_PATH_COMPONENT_LENGTH + 1], path[2 * MAX_PATH_COMPONENT_LENGTH + 3];
+        char name[MAX_PATH_COMPONENT_LENGTH + 1];
+        File *file;
+        int fd;
+
+        memset(longest, 'x', MAX_PATH_COMPONENT_LENGTH);
+        longest[MAX_PATH_COMPONENT_LENGTH] = '\0';
+
+        // Names of any length up to the limit can be used for both kinds of File, at any depth.
+        cheat_assert(sfs_create("/a_long_directory", 1) == 0);
+        sprintf(path, "/a_long_directory/%s", longest);
+        cheat_assert(sfs_create(path, 0) == 0);
+        cheat_assert(sfs_create("/a_long_directory/short", 0) == 0);
+        cheat_assert(sfs_create(path, 0) == SFS_ERR_NAME_TAKEN);
+        cheat_assert((fd = sfs_open(path)) >= 0);
+        cheat_assert(sfs_write(fd, -1, 5, "hello") == 0);
+        cheat_assert(sfs_close(fd) == 0);
+
+        // The names are kept across mounts, and listed in full.
+        for (int pass = 0; pass < 2; pass++) {
+            cheat_assert(sfs_getsize(path) == 5);
+            cheat_assert((fd = sfs_open("/a_long_directory")) >= 0);
+            cheat_assert(sfs_readdir(fd, name) == 1 && strcmp(name, "short") == 0);
+            cheat_assert(sfs_readdir(fd, name) == 1 && strcmp(name, longest) == 0);
+            cheat_assert(sfs_readdir(fd, name) == 0);
+            cheat_assert(sfs_close(fd) == 0);
+
+            if (pass == 0) {
+                cheat_assert(sfs_close(test_fd) == 0);
+                cheat_assert(sfs_initialize(0) == 0);
+            }
+        }
+        cheat_assert(FileSystem_check(false) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+
+        // Each long name is held by Files of its own, which are given back when it's deleted.
+        cheat_assert(File_find_by_path(&file, path) == 0);
+        cheat_assert((file->flags & FILE_LONG_NAME) && file->nameLength == MAX_PATH_COMPONENT_LENGTH);
+        cheat_assert(File_get(file->nameFirst)->type == FTYPE_NAME);
+        FileID count = File_count();
+        for (int i = 0; i < 8; i++) {
+            cheat_assert(sfs_delete(path) == 0);
+            cheat_assert(sfs_create(path, 1) == 0);
+        }
+        cheat_assert(File_count() == count);
+
+        // Names that differ only after the part stored in the File itself are still told apart.
+        cheat_assert(sfs_create("/abcdefg1", 0) == 0);
+        cheat_assert(sfs_create("/abcdefg2", 0) == 0);
+        cheat_assert(sfs_delete("/abcdefg1") == 0);
+        cheat_assert(sfs_getsize("/abcdefg2") == 0);
+        cheat_assert(sfs_getsize("/abcdefg1") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(FileSystem_check(false) == 0);
 )
 
 CHEAT_TEST(File_save,
-        cheat_assert(File_save(&files[0]) == 0);
+        cheat_assert(File_save(File_get(0)) == 0);
+)
+
+CHEAT_TEST(File_encode,
+        File *testFile = File_find_by_descriptor(test_fd), decoded;
+        uint8_t buffer[INODE_SIZE];
+
+        // The encoded File should decode back to the same File.
+        testFile->size = 0x1234;
+        File_encode(testFile, buffer);
+        File_decode(&decoded, buffer);
+
+        cheat_assert(decoded.type == FTYPE_DATA);
+        cheat_assert(strcmp(decoded.name, TEST_FILE_NAME) == 0);
+        cheat_assert(decoded.parentDirectoryID == 0);
+        cheat_assert(decoded.size == 0x1234);
+        cheat_assert(decoded.indirectBlock == -1);
+        cheat_assert(decoded.extents[0].start == MAX_BLOCKS-1 && decoded.extents[0].length == 1);
+
+        // The size is stored little-endian, whatever the platform.
+        cheat_assert(buffer[12] == 0x34 && buffer[13] == 0x12);
+)
+
+CHEAT_TEST(InodeTable_grow,
+        char path[16];
+        const int fileCount = 3 * FILES_PER_CHUNK;
+
+        // The inode table grows as Files are created.
+        cheat_assert(File_count() == FILES_PER_CHUNK);
+        for (int i = 0; i < fileCount; i++) {
+            sprintf(path, "/f%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+        cheat_assert(File_count() > (FileID)fileCount);
+
+        // All of the Files should be found again after reloading.
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(File_count() > (FileID)fileCount);
+        for (int i = 0; i < fileCount; i++) {
+            sprintf(path, "/f%d", i);
+            cheat_assert(sfs_gettype(path) == 0);
+        }
+)
+
+CHEAT_TEST(InodeCache_trim,
+        char path[16];
+        File *testFile = File_find_by_descriptor(test_fd);
+
+        // Creating many Files means most of them have to be freed from memory again.
+        for (int i = 0; i < 2 * INODE_CACHE_SIZE; i++) {
+            sprintf(path, "/c%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+
+        // Open Files stay in memory, and the rest are loaded again when needed.
+        cheat_assert(File_get(testFile->id) == testFile);
+        cheat_assert(File_find_by_descriptor(test_fd) == testFile);
+        for (int i = 0; i < 2 * INODE_CACHE_SIZE; i++) {
+            sprintf(path, "/c%d", i);
+            cheat_assert(sfs_getsize(path) == 0);
+        }
+)
+
+CHEAT_TEST(File_load_contents,
+        char name[MAX_PATH_COMPONENT_LENGTH + 1];
+        int fd;
+
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_create("/d", 1) == 0);
+        cheat_assert(sfs_create("/d/a", 0) == 0);
+        cheat_assert(sfs_create("/d/b", 1) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+
+        // Directory sizes are saved, and their lists of contents aren't built until they're needed.
+        cheat_assert(File_get(0)->size == 2);
+        cheat_assert(File_get(0)->contentsLoaded == false);
+        cheat_assert(sfs_getsize("/d") == 2);
+
+        File *directory = NULL;
+        cheat_assert(File_find_by_path(&directory, "/d") == 0);
+        cheat_assert(directory->contentsLoaded == false);
+
+        cheat_assert((fd = sfs_open("/d")) >= 0);
+        cheat_assert(sfs_readdir(fd, name) == 1);
+        cheat_assert(strcmp(name, "a") == 0);
+        cheat_assert(sfs_readdir(fd, name) == 1);
+        cheat_assert(strcmp(name, "b") == 0);
+        cheat_assert(sfs_readdir(fd, name) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+
+        // Whether a directory is empty is known from its size, without building its list of contents.
+        cheat_assert(sfs_delete("/d/b") == 0);
+        cheat_assert(sfs_delete("/d/a") == 0);
+        cheat_assert(sfs_create("/e", 0) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_delete("/d") == 0);
+        cheat_assert(File_find_by_path(&directory, "/e") == 0);
+        cheat_assert(File_get(0)->size == 2);
+)
+
+CHEAT_TEST(FileSystem_check,
+        char buffer[BLOCK_SIZE];
+        int fd;
+
+        memset(buffer, 'x', sizeof(buffer));
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_create("/d", 1) == 0);
+        cheat_assert(sfs_create("/d/a", 0) == 0);
+        cheat_assert((fd = sfs_open("/d/a")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_write(fd, -1, FRAGMENT_SIZE, buffer) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+
+        // A file system that was unmounted cleanly doesn't need repairing.
+        cheat_assert(sfs_initialize(0) == 0);
+        unsigned int freeCount = Block_count_free();
+        cheat_assert(FileSystem_check(false) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(Block_count_free() == freeCount);
+
+        // If the program stops without unmounting, the file system needs repairing.
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert((fd = sfs_open("/b")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_sync() == 0);
+        freeCount = Block_count_free();
+        FileSystem_unmount(false);
+
+        cheat_assert(FileSystem_check(false) == SFS_ERR_NEEDS_CHECK);
+        cheat_assert(FileSystem_check(true) == 0);
+        cheat_assert(FileSystem_check(false) == 0);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(Block_count_free() == freeCount);
+        cheat_assert(sfs_getsize("/b") == BLOCK_SIZE);
+        cheat_assert(sfs_getsize("/d") == 1);
+
+        // If the data held in memory can't be saved, the error is reported and the file system stays mounted.
+        bool wasFree[MAX_BLOCKS];
+        cheat_assert((fd = sfs_open("/b")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        memcpy(wasFree, freeBlocks, sizeof(wasFree));
+        memset(freeBlocks, 0, sizeof(wasFree));
+        cheat_assert(sfs_initialize(0) == SFS_ERR_NO_MORE_BLOCKS);
+        cheat_assert(FileSystem_check(false) == SFS_ERR_NO_MORE_BLOCKS);
+        cheat_assert(sfs_getsize("/b") == 2 * BLOCK_SIZE);
+
+        memcpy(freeBlocks, wasFree, sizeof(wasFree));
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/b") == 2 * BLOCK_SIZE);
+        cheat_assert(FileSystem_check(false) == 0);
+)
+
+CHEAT_TEST(Journal_recover,
+        char buffer[BLOCK_SIZE];
+        int fd;
+
+        memset(buffer, 'x', sizeof(buffer));
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+
+        // Changes made before sfs_sync survive a crash, and the journal makes the file system consistent again.
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_delete(TEST_FILE_PATH) == 0);
+        cheat_assert(sfs_sync() == 0);
+        unsigned int freeCount = Block_count_free();
+
+        // Changes made after it are lost.
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert(sfs_delete("/a") == 0);
+
+        // Pretend the crash happened before the last commit was written to where its blocks belong.
+        BlockID tableBlock;
+        cheat_assert(File_get_block(&inodeTable, 0, &tableBlock) == 0);
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(put_block(tableBlock, buffer) == 0);
+        FileSystem_unmount(false);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/a") == BLOCK_SIZE);
+        cheat_assert(sfs_getsize("/b") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(sfs_getsize(TEST_FILE_PATH) == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(Block_count_free() == freeCount);
+        cheat_assert(FileSystem_check(false) == 0);
+)
+
+CHEAT_TEST(Journal_operation_atomic,
+        char longest[MAX_PATH_COMPONENT_LENGTH + 1], path[MAX_PATH_COMPONENT_LENGTH + 4];
+        char name[MAX_PATH_COMPONENT_LENGTH + 1];
+        int fd, count;
+
+        memset(longest, 'x', MAX_PATH_COMPONENT_LENGTH);
+        longest[MAX_PATH_COMPONENT_LENGTH] = '\0';
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_create("/d", 1) == 0);
+
+        // Fill four chunks of the inode table, where "/d/<i>" is File i + 3,
+        //   then leave a single empty File in each of its first 11 blocks,
+        //   so that the parts of a long name are spread over more blocks than a small transaction holds.
+        for (int i = 0; i < 4 * FILES_PER_CHUNK - 3; i++) {
+            sprintf(path, "/d/%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+        for (int i = 0; i < 11 * INODES_PER_BLOCK; i += INODES_PER_BLOCK) {
+            sprintf(path, "/d/%d", i);
+            cheat_assert(sfs_delete(path) == 0);
+        }
+        cheat_assert(sfs_sync() == 0);
+
+        // Fill some of the running transaction with Files in the table's last blocks, which have no room,
+        //   then create a File whose name needs more blocks than are left.
+        for (int i = 12 * INODES_PER_BLOCK - 2; i < 4 * FILES_PER_CHUNK - 3; i += INODES_PER_BLOCK) {
+            sprintf(path, "/d/%d", i);
+            cheat_assert((fd = sfs_open(path)) >= 0);
+            cheat_assert(sfs_write(fd, -1, 1, "x") == 0);
+            cheat_assert(sfs_close(fd) == 0);
+        }
+        sprintf(path, "/d/%s", longest);
+        cheat_assert(sfs_create(path, 0) == 0);
+
+        // Whatever was committed when the program stops, the directory still matches its contents.
+        FileSystem_unmount(false);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert((fd = sfs_open("/d")) >= 0);
+        for (count = 0; sfs_readdir(fd, name) == 1; count++) {
+        }
+        cheat_assert(count == sfs_getsize("/d") && count > 0);
+        cheat_assert(sfs_close(fd) == 0);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(FileSystem_check(false) == 0);
+)
+
+CHEAT_TEST(Shadow_commit,
+        char buffer[BLOCK_SIZE];
+        BlockID tableBlock;
+        int fd;
+
+        memset(buffer, 'x', sizeof(buffer));
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_format(-1) == SFS_ERR_INVALID_MODE);
+        cheat_assert(sfs_format(SFS_MODE_COW) == 0);
+        cheat_assert(File_get_block(&inodeTable, 0, &tableBlock) == 0);
+        BlockID location = Shadow_locate(tableBlock);
+
+        // A commit writes the blocks it changes somewhere other than their last committed copy.
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(Shadow_locate(tableBlock) != location);
+        unsigned int freeCount = Block_count_free();
+
+        // Changes made after the last commit are lost in a crash, and nothing needs to be recovered.
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert(sfs_delete("/a") == 0);
+        FileSystem_unmount(false);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(commitMode == COMMIT_COW);
+        cheat_assert(sfs_getsize("/a") == BLOCK_SIZE);
+        cheat_assert(sfs_getsize("/b") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(Block_count_free() == freeCount);
+        cheat_assert(FileSystem_check(false) == 0);
+
+        // The copies that are replaced are freed again.
+        cheat_assert(sfs_initialize(0) == 0);
+        for (int i = 0; i < 4; i++) {
+            cheat_assert(sfs_create("/c", 0) == 0);
+            cheat_assert(sfs_delete("/c") == 0);
+            cheat_assert(sfs_sync() == 0);
+        }
+        cheat_assert(Block_count_free() == freeCount);
+        cheat_assert(FileSystem_check(false) == 0);
+
+        // Writes stop short of the blocks kept for committing, so a full device can still be closed and emptied.
+        int result;
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_create("/d", 0) == 0);
+        cheat_assert((fd = sfs_open("/d")) >= 0);
+        do {
+            result = sfs_write(fd, -1, BLOCK_SIZE, buffer);
+        } while (result == 0);
+        cheat_assert(result == SFS_ERR_NO_MORE_BLOCKS);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(sfs_delete("/d") == 0);
+        cheat_assert(sfs_sync() == 0);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/d") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(sfs_getsize("/a") == BLOCK_SIZE);
+        cheat_assert(Block_count_free() == freeCount);
+        cheat_assert(FileSystem_check(false) == 0);
+)
+
+CHEAT_TEST(log_structured,
+        char buffer[BLOCK_SIZE];
+        BlockID first, last;
+        int fd;
+
+        memset(buffer, 'x', sizeof(buffer));
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_format(SFS_MODE_LOG) == 0);
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        for (int i = 0; i < 4; i++) {
+            cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        }
+        cheat_assert(sfs_sync() == 0);
+
+        File *file = File_find_by_descriptor(fd);
+        cheat_assert(File_get_block(file, 0, &first) == 0);
+        cheat_assert(File_get_block(file, 3, &last) == 0);
+
+        // Overwrites aren't written in place, but one after another in the next segment.
+        memset(buffer, 'y', sizeof(buffer));
+        cheat_assert(sfs_write(fd, 3 * BLOCK_SIZE, 16, buffer) == 0);
+        cheat_assert(sfs_write(fd, 0, 16, buffer) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(Shadow_locate(last) != last);
+        cheat_assert(Shadow_locate(first) == Shadow_locate(last) + 1);
+
+        cheat_assert(get_block(first, buffer) == 0);
+        cheat_assert(buffer[0] == 'x');
+        cheat_assert(sfs_read(fd, 0, 16, buffer) == 0);
+        cheat_assert(buffer[0] == 'y');
+        cheat_assert(sfs_close(fd) == 0);
+
+        // The overwrites are where the shadow map says after the file system is mounted again.
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_read(fd, 3 * BLOCK_SIZE, 16, buffer) == 0);
+        cheat_assert(buffer[0] == 'y');
+        cheat_assert(sfs_read(fd, BLOCK_SIZE, 16, buffer) == 0);
+        cheat_assert(buffer[0] == 'x');
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(FileSystem_check(false) == 0);
+
+        // Filling the device doesn't stop the log: the file that filled it can be deleted, and the rest survives.
+        int result;
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert((fd = sfs_open("/b")) >= 0);
+        do {
+            result = sfs_write(fd, -1, BLOCK_SIZE, buffer);
+        } while (result == 0);
+        cheat_assert(result == SFS_ERR_NO_MORE_BLOCKS);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_create("/c", 0) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(sfs_delete("/b") == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(sfs_sync() == 0);
+
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/a") == 4 * BLOCK_SIZE);
+        cheat_assert(sfs_getsize("/b") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(sfs_gettype("/c") == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_read(fd, 3 * BLOCK_SIZE, 16, buffer) == 0);
+        cheat_assert(buffer[0] == 'y');
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(FileSystem_check(false) == 0);
 )
 
-CHEAT_TEST(path_to_tokens,
-        char **tokens;
+CHEAT_TEST(snapshots,
+        char buffer[BLOCK_SIZE];
+        int fd, snapshot;
+
+        // The journal doesn't keep old copies of blocks around.
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_snapshot_create() == SFS_ERR_INVALID_MODE);
+
+        cheat_assert(sfs_format(SFS_MODE_COW) == 0);
+        memset(buffer, 'x', sizeof(buffer));
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert((snapshot = sfs_snapshot_create()) >= 0);
+
+        // Changing the live file system, even deleting the file, leaves the snapshot as it was.
+        memset(buffer, 'y', sizeof(buffer));
+        cheat_assert(sfs_write(fd, 0, 16, buffer) == 0);
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(sfs_delete("/a") == 0);
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(FileSystem_check(false) == 0);
+
+        cheat_assert(sfs_snapshot_mount_readonly(snapshot) == 0);
+        cheat_assert(sfs_getsize("/a") == 2 * BLOCK_SIZE);
+        cheat_assert(sfs_getsize("/b") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert((fd = sfs_open("/a")) >= 0);
+        cheat_assert(sfs_read(fd, 0, 16, buffer) == 0);
+        cheat_assert(buffer[0] == 'x');
+        cheat_assert(sfs_write(fd, 0, 16, buffer) == SFS_ERR_READ_ONLY);
+        cheat_assert(sfs_create("/c", 0) == SFS_ERR_READ_ONLY);
+        cheat_assert(sfs_close(fd) == 0);
+
+        // The live file system is still there, and the blocks only the snapshot used are freed once it's deleted.
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/a") == SFS_ERR_FILE_NOT_FOUND);
+        cheat_assert(sfs_getsize("/b") == 0);
+        unsigned int freeCount = Block_count_free();
+        cheat_assert(sfs_snapshot_delete(snapshot) == 0);
+        cheat_assert(Block_count_free() > freeCount);
+        cheat_assert(sfs_snapshot_delete(snapshot) == SFS_ERR_SNAPSHOT_NOT_FOUND);
+        cheat_assert(FileSystem_check(false) == 0);
+        cheat_assert(sfs_snapshot_mount_readonly(snapshot) == SFS_ERR_SNAPSHOT_NOT_FOUND);
+
+        // A snapshot of a full device can still be deleted after its data has been overwritten,
+        //   since deleting it is the only way to get the blocks it pins back.
+        int result;
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_create("/d", 0) == 0);
+        cheat_assert((fd = sfs_open("/d")) >= 0);
+        do {
+            result = sfs_write(fd, -1, BLOCK_SIZE, buffer);
+        } while (result == 0);
+        cheat_assert(result == SFS_ERR_NO_MORE_BLOCKS);
+        cheat_assert((snapshot = sfs_snapshot_create()) >= 0);
+
+        result = 0;
+        for (int i = 0; i < 64 && result == 0; i++) {
+            result = sfs_write(fd, i * BLOCK_SIZE, 16, buffer);
+        }
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_delete("/d") == 0);
+        cheat_assert(sfs_sync() == 0);
+        freeCount = Block_count_free();
+        cheat_assert(sfs_snapshot_delete(snapshot) == 0);
+        cheat_assert(Block_count_free() > freeCount);
+        cheat_assert(FileSystem_check(false) == 0);
+)
+
+CHEAT_TEST(File_append_block,
+        File *testFile = File_find_by_descriptor(test_fd);
+        BlockID block;
+
+        // The test file's only block is the last one on the device.
+        cheat_assert(File_get_block(testFile, 0, &block) == 0);
+        cheat_assert(block == MAX_BLOCKS-1);
+        cheat_assert(File_get_block(testFile, 1, &block) == 0);
+        cheat_assert(block == -1);
+
+        // Blocks that aren't contiguous each need their own extent,
+        //   and eventually spill into the indirect and double indirect blocks.
+        const int extentCount = INODE_EXTENTS + 2*EXTENTS_PER_BLOCK;
+        for (int i = 1; i < extentCount; i++) {
+            freeBlocks[50 + 2*i] = false;
+            cheat_assert(File_append_block(testFile, (BlockID)(50 + 2*i)) == 0);
+        }
+        cheat_assert(testFile->indirectBlock >= 0);
+        cheat_assert(testFile->doubleIndirectBlock >= 0);
+
+        for (int i = 1; i < extentCount; i++) {
+            cheat_assert(File_get_block(testFile, (unsigned int)i, &block) == 0);
+            cheat_assert(block == 50 + 2*i);
+        }
+
+        // A contiguous block only grows the last extent.
+        freeBlocks[50 + 2*extentCount - 1] = false;
+        cheat_assert(File_append_block(testFile, (BlockID)(50 + 2*extentCount - 1)) == 0);
+        cheat_assert(File_get_block(testFile, (unsigned int)extentCount, &block) == 0);
+        cheat_assert(block == 50 + 2*extentCount - 1);
+        cheat_assert(File_get_block(testFile, (unsigned int)extentCount + 1, &block) == 0);
+        cheat_assert(block == -1);
+
+        // The whole map should survive reloading the file system.
+        testFile->size = (extentCount + 1) * BLOCK_SIZE;
+        cheat_assert(File_save(testFile) == 0);
+        FileID testID = testFile->id;
+        cheat_assert(sfs_initialize(0) == 0);
+        testFile = File_get(testID);
+        cheat_assert(File_get_block(testFile, (unsigned int)extentCount - 1, &block) == 0);
+        cheat_assert(block == 50 + 2*(extentCount - 1));
+
+        // Freeing the file should release every block, including the map blocks, once the free is committed.
+        BlockID indirectBlock = testFile->indirectBlock;
+        cheat_assert(File_free_blocks(testFile) == 0);
+        cheat_assert(!freeBlocks[indirectBlock]);
+        cheat_assert(Journal_commit() == 0);
+        cheat_assert(freeBlocks[indirectBlock]);
+        cheat_assert(freeBlocks[50 + 2*extentCount - 1]);
+)
+
+CHEAT_TEST(Block_allocate_near,
+        char buffer[BLOCK_SIZE];
+        memset(buffer, 'A', sizeof(buffer));
+
+        // Appending to two files at once should still leave each of them contiguous.
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert(sfs_create("/b", 0) == 0);
+        int a_fd = sfs_open("/a"), b_fd = sfs_open("/b");
+
+        for (int i = 0; i < RESERVATION_BLOCKS * 2; i++) {
+            cheat_assert(sfs_write(a_fd, -1, BLOCK_SIZE, buffer) == 0);
+            cheat_assert(sfs_write(b_fd, -1, BLOCK_SIZE, buffer) == 0);
+        }
+
+        File *a = File_find_by_descriptor(a_fd), *b = File_find_by_descriptor(b_fd);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(a->extents[0].length >= RESERVATION_BLOCKS);
+        cheat_assert(b->extents[0].length >= RESERVATION_BLOCKS);
+        cheat_assert(a->indirectBlock == -1 && b->indirectBlock == -1);
+
+        // A goal that is free should be used as is.
+        BlockID start;
+        unsigned int length;
+        cheat_assert(Block_allocate_near(a, MAX_BLOCKS-10, 4, &start, &length) == 0);
+        cheat_assert(start == MAX_BLOCKS-10 && length == 4);
+
+        // A goal that is in use should fall back to the nearest run that is long enough.
+        cheat_assert(Block_allocate_near(a, MAX_BLOCKS-10, 2, &start, &length) == 0);
+        cheat_assert(start == MAX_BLOCKS-6 && length == 2);
+
+        cheat_assert(sfs_close(a_fd) == 0);
+        cheat_assert(sfs_close(b_fd) == 0);
+)
+
+CHEAT_TEST(PathIterator,
+        PathIterator iterator;
+        File *file;
 
         // Empty path should fail.
-        cheat_assert(path_to_tokens("", &tokens) == SFS_ERR_INVALID_PATH);
-
-        // "/" should result in [].
-        cheat_assert(path_to_tokens("/", &tokens) == 0);
-        cheat_assert(tokens[0] == NULL);
-        free_tokens(&tokens);
-
-        // "/foo" should result in ["foo"].
-        cheat_assert(path_to_tokens("/foo", &tokens) == 0);
-        cheat_assert(strcmp(tokens[0], "foo") == 0);
-        cheat_assert(tokens[1] == NULL);
-        free_tokens(&tokens);
-
-        // "/foo/bar" should result in ["foo", "bar"].
-        cheat_assert(path_to_tokens("/foo/bar", &tokens) == 0);
-        cheat_assert(strcmp(tokens[0], "foo") == 0);
-        cheat_assert(strcmp(tokens[1], "bar") == 0);
-        cheat_assert(tokens[2] == NULL);
-        free_tokens(&tokens);
+        cheat_assert(PathIterator_start(&iterator, "") == SFS_ERR_INVALID_PATH);
+
+        // "/" should have no components.
+        cheat_assert(PathIterator_start(&iterator, "/") == 0);
+        cheat_assert(PathIterator_next(&iterator) == 0);
+
+        // "/foo" should have the component "foo".
+        cheat_assert(PathIterator_start(&iterator, "/foo") == 0);
+        cheat_assert(PathIterator_next(&iterator) == 1);
+        cheat_assert(iterator.length == 3 && strncmp(iterator.component, "foo", 3) == 0);
+        cheat_assert(PathIterator_is_last(&iterator));
+        cheat_assert(PathIterator_next(&iterator) == 0);
+
+        // "/foo/bar" should have the components "foo" and "bar".
+        cheat_assert(PathIterator_start(&iterator, "/foo/bar") == 0);
+        cheat_assert(PathIterator_next(&iterator) == 1);
+        cheat_assert(iterator.length == 3 && strncmp(iterator.component, "foo", 3) == 0);
+        cheat_assert(!PathIterator_is_last(&iterator));
+        cheat_assert(PathIterator_next(&iterator) == 1);
+        cheat_assert(iterator.length == 3 && strncmp(iterator.component, "bar", 3) == 0);
+        cheat_assert(PathIterator_next(&iterator) == 0);
 
         // A path that ends with a '/' should fail.
-        cheat_assert(path_to_tokens("/foo/", &tokens) == SFS_ERR_INVALID_PATH);
+        cheat_assert(PathIterator_start(&iterator, "/foo/") == 0);
+        cheat_assert(PathIterator_next(&iterator) == 1);
+        cheat_assert(PathIterator_next(&iterator) == SFS_ERR_INVALID_PATH);
 
-        // A path with a token that's length is > MAX_PATH_COMPONENT_LENGTH should fail.
+        // A path with a component that's length is > MAX_PATH_COMPONENT_LENGTH should fail.
         char buffer[1+MAX_PATH_COMPONENT_LENGTH+1+1];
         buffer[0] = '/';
         buffer[MAX_PATH_COMPONENT_LENGTH+2] = '\0';
         memset(buffer+1, 'A', MAX_PATH_COMPONENT_LENGTH+1);
-        cheat_assert(path_to_tokens(buffer, &tokens) == SFS_ERR_INVALID_NAME);
+        cheat_assert(PathIterator_start(&iterator, buffer) == 0);
+        cheat_assert(PathIterator_next(&iterator) == SFS_ERR_INVALID_NAME);
 
-        // A path with a token that's length is MAX_PATH_COMPONENT_LENGTH should succeed.
+        // A path with a component that's length is MAX_PATH_COMPONENT_LENGTH should succeed.
         buffer[MAX_PATH_COMPONENT_LENGTH+1] = '\0';
-        cheat_assert(path_to_tokens(buffer, &tokens) == 0);
-        cheat_assert(strncmp(tokens[0], buffer+1, MAX_PATH_COMPONENT_LENGTH) == 0);
-        free_tokens(&tokens);
+        cheat_assert(PathIterator_start(&iterator, buffer) == 0);
+        cheat_assert(PathIterator_next(&iterator) == 1);
+        cheat_assert(iterator.length == MAX_PATH_COMPONENT_LENGTH);
+        cheat_assert(iterator.component == buffer + 1);
+
+        // Problems with the path itself are reported before problems finding the Files in it,
+        //   even though the walk stops before it gets to them.
+        cheat_assert(File_find_by_path(&file, "/nope/foo/") == SFS_ERR_INVALID_PATH);
+        char longPath[sizeof("/nope/") + MAX_PATH_COMPONENT_LENGTH + 1];
+        sprintf(longPath, "/nope/%sA", buffer + 1);
+        cheat_assert(File_find_by_path(&file, longPath) == SFS_ERR_INVALID_NAME);
+        cheat_assert(File_find_by_path(&file, "/AAAAAAAA/foo/") == SFS_ERR_INVALID_PATH);
+        cheat_assert(File_find_by_path(&file, "/nope/foo") == SFS_ERR_FILE_NOT_FOUND);
 )
 
 CHEAT_TEST(sfs_initialize,
@@ -149,8 +884,8 @@ CHEAT_TEST(sfs_initialize,
         cheat_assert(sfs_initialize(0) == 0);
 
         // Root file should be created with initialize.
-        cheat_assert(files[0].type == FTYPE_DIR);
-        cheat_assert(strcmp(files[0].name, "/") == 0);
+        cheat_assert(File_get(0)->type == FTYPE_DIR);
+        cheat_assert(strcmp(File_get(0)->name, "/") == 0);
 )
 
 CHEAT_TEST(sfs_getsize,
@@ -193,6 +928,70 @@ CHEAT_TEST(sfs_readdir,
         cheat_assert(sfs_readdir(MAX_OPEN_FILES, nameBuffer) == SFS_ERR_BAD_FD);
 )
 
+CHEAT_TEST(readdir_cursor,
+        char name[MAX_PATH_COMPONENT_LENGTH + 1];
+
+        cheat_assert(sfs_create("/b", 0) == 0);
+        cheat_assert(sfs_create("/d", 0) == 0);
+        cheat_assert(sfs_create("/f", 0) == 0);
+
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "b") == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "d") == 0);
+
+        // Changes to the directory don't restart the listing.
+        // Names added before the cursor are skipped, and those after it are listed.
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert(sfs_create("/e", 0) == 0);
+        cheat_assert(sfs_delete("/b") == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "e") == 0);
+
+        // Even the File the cursor stopped at can be removed.
+        cheat_assert(sfs_delete("/e") == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "f") == 0);
+        cheat_assert(sfs_delete("/f") == 0);
+        cheat_assert(sfs_create("/f", 0) == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, TEST_FILE_NAME) == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 0);
+
+        // Once it's over, the listing starts again.
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "a") == 0);
+)
+
+CHEAT_TEST(sfs_readdir_batch,
+        sfs_dirent entries[3];
+        char name[MAX_PATH_COMPONENT_LENGTH + 1];
+        int fd;
+
+        cheat_assert(sfs_create("/d", 1) == 0);
+        cheat_assert(sfs_create("/d/x", 0) == 0);
+        cheat_assert(sfs_create("/e", 0) == 0);
+        cheat_assert(sfs_create("/f", 0) == 0);
+        cheat_assert((fd = sfs_open("/f")) >= 0);
+        cheat_assert(sfs_write(fd, -1, 5, "hello") == 0);
+
+        // Names, types and sizes come back together, in the same order as sfs_readdir.
+        cheat_assert(sfs_readdir_batch(root_fd, entries, 3) == 3);
+        cheat_assert(strcmp(entries[0].name, "d") == 0 && entries[0].type == 1 && entries[0].size == 1);
+        cheat_assert(strcmp(entries[1].name, "e") == 0 && entries[1].type == 0 && entries[1].size == 0);
+        cheat_assert(strcmp(entries[2].name, "f") == 0 && entries[2].type == 0 && entries[2].size == 5);
+        cheat_assert(entries[2].inode == File_find_by_descriptor(fd)->id);
+
+        // A batch that reaches the end is short, and the next one reports the end.
+        cheat_assert(sfs_readdir_batch(root_fd, entries, 3) == 1);
+        cheat_assert(strcmp(entries[0].name, TEST_FILE_NAME) == 0);
+        cheat_assert(entries[0].size == sizeof(TEST_FILE_DATA));
+        cheat_assert(sfs_readdir_batch(root_fd, entries, 3) == 0);
+
+        // Batches share their place in the listing with sfs_readdir.
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "d") == 0);
+        cheat_assert(sfs_readdir_batch(root_fd, entries, 1) == 1 && strcmp(entries[0].name, "e") == 0);
+        cheat_assert(sfs_readdir(root_fd, name) == 1 && strcmp(name, "f") == 0);
+
+        cheat_assert(sfs_readdir_batch(test_fd, entries, 3) == SFS_ERR_BAD_FILE_TYPE);
+        cheat_assert(sfs_readdir_batch(MAX_OPEN_FILES, entries, 3) == SFS_ERR_BAD_FD);
+        cheat_assert(sfs_close(fd) == 0);
+)
+
 CHEAT_TEST(sfs_open,
         // Opening the test file should succeed.
         int fd1 = sfs_open(TEST_FILE_PATH);
@@ -232,6 +1031,65 @@ CHEAT_TEST(sfs_create,
 
         // Create TEST_FILE_NAME again, this should fail.
         cheat_assert(sfs_create(TEST_FILE_PATH, 0) == SFS_ERR_NAME_TAKEN);
+        cheat_assert(sfs_create("/", 1) == SFS_ERR_NAME_TAKEN);
+
+        // Badly formed paths are reported as such, even when their parent doesn't exist.
+        cheat_assert(sfs_create("/nope/foo/", 0) == SFS_ERR_INVALID_PATH);
+        char longPath[sizeof("/nope/") + MAX_PATH_COMPONENT_LENGTH + 1];
+        strcpy(longPath, "/nope/");
+        memset(longPath + 6, 'A', MAX_PATH_COMPONENT_LENGTH + 1);
+        longPath[sizeof(longPath) - 1] = '\0';
+        cheat_assert(sfs_create(longPath, 0) == SFS_ERR_INVALID_NAME);
+
+        // Files can be created in a deep tree, whether the parent's path has been looked up before or not.
+        cheat_assert(sfs_create("/a", 1) == 0);
+        cheat_assert(sfs_create("/a/b", 1) == 0);
+        cheat_assert(sfs_create("/a/b/c", 1) == 0);
+        cheat_assert(sfs_create("/a/b/c/d", 0) == 0);
+        cheat_assert(sfs_create("/a/b/c/e", 0) == 0);
+        cheat_assert(sfs_create("/a/b/c/d", 0) == SFS_ERR_NAME_TAKEN);
+        cheat_assert(sfs_create("/a/b/c/d/f", 0) == SFS_ERR_BAD_FILE_TYPE);
+        cheat_assert(sfs_create("/a/b/c/d/f", 0) == SFS_ERR_BAD_FILE_TYPE);
+        cheat_assert(sfs_gettype("/a/b/c/e") == 0);
+        cheat_assert(sfs_getsize("/a/b/c") == 2);
+)
+
+CHEAT_TEST(sfs_create_full,
+        char path[MAX_PATH_COMPONENT_LENGTH + 4], name[MAX_PATH_COMPONENT_LENGTH + 1];
+        bool wasFree[MAX_BLOCKS];
+        int fd, count;
+
+        // Leave four empty Files in the inode table, and no blocks for it to grow.
+        cheat_assert(sfs_create("/d", 1) == 0);
+        for (int i = 0; i < FILES_PER_CHUNK - 7; i++) {
+            sprintf(path, "/d/%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+        memcpy(wasFree, freeBlocks, sizeof(wasFree));
+        memset(freeBlocks, 0, sizeof(wasFree));
+
+        // A name that needs more Files than are left can't be created, and leaves all four of them empty.
+        strcpy(path, "/d/");
+        memset(path + 3, 'x', MAX_PATH_COMPONENT_LENGTH);
+        path[sizeof(path) - 1] = '\0';
+        cheat_assert(sfs_create(path, 0) < 0);
+        for (int i = 0; i < 4; i++) {
+            sprintf(path, "/d/y%d", i);
+            cheat_assert(sfs_create(path, 0) == 0);
+        }
+        memcpy(freeBlocks, wasFree, sizeof(wasFree));
+
+        // The directory lists the same Files, both now and once it is loaded again from the device.
+        for (int mount = 0; mount < 2; mount++) {
+            cheat_assert((fd = sfs_open("/d")) >= 0);
+            for (count = 0; sfs_readdir(fd, name) == 1; count++) {
+            }
+            cheat_assert(count == FILES_PER_CHUNK - 3);
+            cheat_assert(count == sfs_getsize("/d"));
+            cheat_assert(sfs_close(fd) == 0);
+            cheat_assert(sfs_initialize(0) == 0);
+        }
+        cheat_assert(FileSystem_check(false) == 0);
 )
 
 CHEAT_TEST(sfs_delete,
@@ -258,6 +1116,128 @@ CHEAT_TEST(sfs_delete,
         cheat_assert(sfs_delete(TEST_FILE_PATH "2") == 0);
 )
 
+CHEAT_TEST(sfs_sync,
+        char buffer[BLOCK_SIZE];
+        memset(buffer, 'S', sizeof(buffer));
+
+        cheat_assert(sfs_create("/sync", 0) == 0);
+        int fd = sfs_open("/sync");
+        File *file = File_find_by_descriptor(fd);
+
+        // Appended blocks are held in memory, but can still be read.
+        cheat_assert(sfs_write(fd, -1, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(sfs_write(fd, -1, 10, buffer) == 0);
+        cheat_assert(file->extents[0].length == 0);
+        cheat_assert(sfs_getsize("/sync") == BLOCK_SIZE + 10);
+
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(fd, BLOCK_SIZE, 10, buffer) == 0);
+        cheat_assert(buffer[0] == 'S' && buffer[9] == 'S');
+
+        // Syncing gives all of the blocks a place on the device at once, with the partial last block in fragments.
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(file->extents[0].length == 1);
+        cheat_assert(File_has_tail(file));
+        cheat_assert(PendingData_find(file) == NULL);
+
+        // The data should still be there after reloading.
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(sfs_getsize("/sync") == BLOCK_SIZE + 10);
+        fd = sfs_open("/sync");
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(fd, BLOCK_SIZE, 10, buffer) == 0);
+        cheat_assert(buffer[0] == 'S' && buffer[9] == 'S');
+)
+
+CHEAT_TEST(inline_data,
+        char buffer[BLOCK_SIZE];
+        memset(buffer, 'I', sizeof(buffer));
+
+        cheat_assert(sfs_create("/tiny", 0) == 0);
+        int fd = sfs_open("/tiny");
+        File *file = File_find_by_descriptor(fd);
+
+        // A tiny file's contents are kept in the File itself.
+        cheat_assert(sfs_write(fd, -1, 10, buffer) == 0);
+        cheat_assert(File_is_inline(file));
+        cheat_assert(PendingData_find(file) == NULL);
+
+        cheat_assert(sfs_close(fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        fd = sfs_open("/tiny");
+        file = File_find_by_descriptor(fd);
+        cheat_assert(File_is_inline(file));
+
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(fd, 0, 10, buffer) == 0);
+        cheat_assert(buffer[0] == 'I' && buffer[9] == 'I');
+
+        // Growing past the inline area moves the contents into a block.
+        memset(buffer, 'J', sizeof(buffer));
+        cheat_assert(sfs_write(fd, -1, INLINE_DATA_SIZE, buffer) == 0);
+        cheat_assert(!File_is_inline(file));
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(file->extents[0].length == 0 && File_has_tail(file));
+
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(fd, 0, 10 + INLINE_DATA_SIZE, buffer) == 0);
+        cheat_assert(buffer[9] == 'I' && buffer[10] == 'J' && buffer[9 + INLINE_DATA_SIZE] == 'J');
+)
+
+CHEAT_TEST(fragments,
+        char buffer[BLOCK_SIZE];
+        memset(buffer, 'F', sizeof(buffer));
+
+        // The set-up's test file isn't saved, so reload first to count the blocks as they'll be after reloading.
+        cheat_assert(sfs_close(test_fd) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        unsigned int freeBefore = Block_count_free();
+
+        // The tails of small files share one block.
+        cheat_assert(sfs_create("/a", 0) == 0);
+        cheat_assert(sfs_create("/b", 0) == 0);
+        int a = sfs_open("/a"), b = sfs_open("/b");
+        cheat_assert(sfs_write(a, -1, 40, buffer) == 0);
+        cheat_assert(sfs_write(b, -1, 20, buffer) == 0);
+        cheat_assert(sfs_sync() == 0);
+
+        File *fileA = File_find_by_descriptor(a), *fileB = File_find_by_descriptor(b);
+        cheat_assert(File_has_tail(fileA) && File_has_tail(fileB));
+        cheat_assert(fileA->tailBlock == fileB->tailBlock);
+        cheat_assert(Block_count_free() == freeBefore - 1);
+
+        // The tails survive reloading.
+        cheat_assert(sfs_close(a) == 0);
+        cheat_assert(sfs_close(b) == 0);
+        cheat_assert(sfs_initialize(0) == 0);
+        cheat_assert(Block_count_free() == freeBefore - 1);
+
+        a = sfs_open("/a");
+        fileA = File_find_by_descriptor(a);
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(a, 0, 40, buffer) == 0);
+        cheat_assert(buffer[0] == 'F' && buffer[39] == 'F');
+
+        // Appending moves the tail back into a whole block.
+        memset(buffer, 'G', sizeof(buffer));
+        cheat_assert(sfs_write(a, -1, 88, buffer) == 0);
+        cheat_assert(!File_has_tail(fileA));
+        cheat_assert(sfs_close(a) == 0);
+        cheat_assert(fileA->extents[0].length == 1 && !File_has_tail(fileA));
+
+        a = sfs_open("/a");
+        memset(buffer, 0, sizeof(buffer));
+        cheat_assert(sfs_read(a, 0, BLOCK_SIZE, buffer) == 0);
+        cheat_assert(buffer[39] == 'F' && buffer[40] == 'G' && buffer[BLOCK_SIZE - 1] == 'G');
+        cheat_assert(sfs_close(a) == 0);
+
+        // The shared block is freed along with the last tail in it.
+        cheat_assert(sfs_delete("/a") == 0);
+        cheat_assert(sfs_delete("/b") == 0);
+        cheat_assert(Block_count_free() == freeBefore);
+)
+
 CHEAT_TEST(sfs_read,
         char buffer[BLOCK_SIZE];
         char referenceBuffer[BLOCK_SIZE];
@@ -339,14 +1319,14 @@ CHEAT_TEST(sfs_write,
         sfs_create(TEST_FILE_PATH, 0);
         test_fd = sfs_open(TEST_FILE_PATH);
 
-        // Writing up to MAX_BLOCKS_PER_FILE blocks should succeed.
-        for (char i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        // Writing several blocks should succeed.
+        for (char i = 0; i < 8; i++) {
             memset(buffer, 'A'+i, BLOCK_SIZE);
             cheat_assert(sfs_write(test_fd, -1, BLOCK_SIZE, buffer) == 0);
         }
 
         // Make sure the writes succeeded.
-        for (char i = 0; i < MAX_BLOCKS_PER_FILE; i++) {
+        for (char i = 0; i < 8; i++) {
             memset(referenceBuffer, 'A'+i, BLOCK_SIZE);
             memset(buffer, 0, BLOCK_SIZE);
             sfs_read(test_fd, i*BLOCK_SIZE, BLOCK_SIZE, buffer);
@@ -356,6 +1336,19 @@ CHEAT_TEST(sfs_write,
         // Writing across the block boundary should fail.
         cheat_assert(sfs_write(test_fd, BLOCK_SIZE-1, 2, buffer) == SFS_ERR_BLOCK_FAULT);
 
-        // Writing too much data should fail.
-        cheat_assert(sfs_write(test_fd, -1, 1, buffer) == SFS_ERR_FILE_FULL);
+        // Blocks written one after another should be stored in a single extent.
+        File *testFile = File_find_by_descriptor(test_fd);
+        cheat_assert(sfs_sync() == 0);
+        cheat_assert(testFile->extents[0].length == 8);
+        cheat_assert(testFile->extents[1].length == 0);
+
+        // Writing should fail once the device runs out of blocks.
+        int result;
+        do {
+            result = sfs_write(test_fd, -1, BLOCK_SIZE, buffer);
+        } while (result == 0);
+        cheat_assert(result == SFS_ERR_NO_MORE_BLOCKS);
+
+        // The file system should still load after being filled.
+        cheat_assert(sfs_initialize(0) == 0);
 )
\ No newline at end of file
@@ -0,0 +1,64 @@
+/*
+ *  Simple Filesystem
+ *  Copyright (C) 2014 Patrick S., Robert C., Aaron P., Matthew R.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * sfs_fsck - Checks the file system on the simulated disk, and repairs it so it can be mounted again.
+ *
+ * A file system that wasn't unmounted cleanly is made consistent by its journal when it's next mounted,
+ *   but this checks everything, e.g. after the journal itself was damaged.
+ *
+ * Usage: sfs_fsck [-n]
+ *
+ *  -n  Only check the file system, without writing anything to the device.
+ *
+ * Exits with 0 if the file system is (now) consistent, 1 if it needs repairing, or 2 if it can't be repaired.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../sfs.h"
+#include "../src/sfs_internal.h"
+
+int main(int argc, char **argv) {
+
+    bool repair = true;
+
+    if (argc == 2 && strcmp(argv[1], "-n") == 0) {
+        repair = false;
+    }
+    else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [-n]\n", argv[0]);
+        return 2;
+    }
+
+    int err_code = FileSystem_check(repair);
+
+    if (err_code == SFS_ERR_NEEDS_CHECK) {
+        printf("The file system needs to be repaired.\n");
+        return 1;
+    }
+    else if (err_code < 0) {
+        fprintf(stderr, "Could not check the file system: %s\n", sfs_error_message(err_code));
+        return 2;
+    }
+
+    printf(repair ? "The file system is clean.\n" : "The file system is consistent.\n");
+    return 0;
+}